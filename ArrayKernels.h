@@ -0,0 +1,207 @@
+#ifndef ARRAY_KERNELS_H
+#define ARRAY_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Elementwise kernels shared by Matrix and the polynomial classes. The
+// generic templates serve any element type; the overloads for float,
+// double, int32_t and int64_t work on 64-byte packs and are compiled once
+// per instruction set (AVX-512, AVX2 and the SSE2 baseline on x86-64), the
+// best one being picked at load time.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ARRAY_SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define ARRAY_SIMD_CLONES
+#endif
+
+template <typename T>
+void addArrays(T* dst, const T* src, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] += src[i];
+}
+
+template <typename T>
+void subtractArrays(T* dst, const T* src, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] -= src[i];
+}
+
+template <typename T, typename Num>
+void scaleArray(T* dst, Num k, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] *= k;
+}
+
+// dst[i] += k * src[i].
+template <typename T>
+void addScaledArray(T* dst, const T& k, const T* src, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] += k * src[i];
+}
+
+// dst[i] *= src[i].
+template <typename T>
+void multiplyArrays(T* dst, const T* src, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] *= src[i];
+}
+
+// dst[i] = dst[i] * x[i] + c, one step of Horner's rule at n points.
+template <typename T>
+void hornerStepArrays(T* dst, const T* x, const T& c, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] = dst[i] * x[i] + c;
+}
+
+// dst[i] += x[i] * y[i].
+template <typename T>
+void multiplyAddArrays(T* dst, const T* x, const T* y, std::size_t n) {
+    for (std::size_t i = 0; i != n; ++i)
+        dst[i] += x[i] * y[i];
+}
+
+#if defined(__GNUC__)
+// Applies op to packs of dst and src, then to the remaining elements one at
+// a time.
+template <typename T, typename Operation>
+inline __attribute__((always_inline)) void transformPacked(T* dst, const T* src, std::size_t n,
+                                                           const Operation& op) {
+    typedef T Pack __attribute__((vector_size(64)));
+    const std::size_t width = sizeof(Pack) / sizeof(T);
+    std::size_t i = 0;
+    for (; i + width <= n; i += width) {
+        Pack a, b;
+        std::memcpy(&a, dst + i, sizeof(Pack));
+        std::memcpy(&b, src + i, sizeof(Pack));
+        op(a, b);
+        std::memcpy(dst + i, &a, sizeof(Pack));
+    }
+    for (; i != n; ++i)
+        op(dst[i], src[i]);
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void addArraysPacked(T* dst, const T* src, std::size_t n) {
+    transformPacked(dst, src, n, [](auto& a, const auto& b) { a += b; });
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void subtractArraysPacked(T* dst, const T* src,
+                                                                std::size_t n) {
+    transformPacked(dst, src, n, [](auto& a, const auto& b) { a -= b; });
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void scaleArrayPacked(T* dst, T k, std::size_t n) {
+    transformPacked(dst, dst, n, [k](auto& a, const auto&) { a *= k; });
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void addScaledArrayPacked(T* dst, T k, const T* src,
+                                                                std::size_t n) {
+    transformPacked(dst, src, n, [k](auto& a, const auto& b) { a += k * b; });
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void multiplyArraysPacked(T* dst, const T* src,
+                                                                std::size_t n) {
+    transformPacked(dst, src, n, [](auto& a, const auto& b) { a *= b; });
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void hornerStepArraysPacked(T* dst, const T* x, T c,
+                                                                  std::size_t n) {
+    transformPacked(dst, x, n, [c](auto& a, const auto& b) { a = a * b + c; });
+}
+
+template <typename T>
+inline __attribute__((always_inline)) void multiplyAddArraysPacked(T* dst, const T* x, const T* y,
+                                                                   std::size_t n) {
+    typedef T Pack __attribute__((vector_size(64)));
+    const std::size_t width = sizeof(Pack) / sizeof(T);
+    std::size_t i = 0;
+    for (; i + width <= n; i += width) {
+        Pack a, b, c;
+        std::memcpy(&a, dst + i, sizeof(Pack));
+        std::memcpy(&b, x + i, sizeof(Pack));
+        std::memcpy(&c, y + i, sizeof(Pack));
+        a += b * c;
+        std::memcpy(dst + i, &a, sizeof(Pack));
+    }
+    for (; i != n; ++i)
+        dst[i] += x[i] * y[i];
+}
+#else
+template <typename T>
+void addArraysPacked(T* dst, const T* src, std::size_t n) {
+    addArrays<T>(dst, src, n);
+}
+
+template <typename T>
+void subtractArraysPacked(T* dst, const T* src, std::size_t n) {
+    subtractArrays<T>(dst, src, n);
+}
+
+template <typename T>
+void scaleArrayPacked(T* dst, T k, std::size_t n) {
+    scaleArray<T, T>(dst, k, n);
+}
+
+template <typename T>
+void addScaledArrayPacked(T* dst, T k, const T* src, std::size_t n) {
+    addScaledArray<T>(dst, k, src, n);
+}
+
+template <typename T>
+void multiplyArraysPacked(T* dst, const T* src, std::size_t n) {
+    multiplyArrays<T>(dst, src, n);
+}
+
+template <typename T>
+void hornerStepArraysPacked(T* dst, const T* x, T c, std::size_t n) {
+    hornerStepArrays<T>(dst, x, c, n);
+}
+
+template <typename T>
+void multiplyAddArraysPacked(T* dst, const T* x, const T* y, std::size_t n) {
+    multiplyAddArrays<T>(dst, x, y, n);
+}
+#endif
+
+// The overloads are inline so that every file including this header may
+// define them.
+#define ARRAY_KERNEL_OVERLOADS(T)                                                               \
+    ARRAY_SIMD_CLONES inline void addArrays(T* dst, const T* src, std::size_t n) {              \
+        addArraysPacked(dst, src, n);                                                           \
+    }                                                                                           \
+    ARRAY_SIMD_CLONES inline void subtractArrays(T* dst, const T* src, std::size_t n) {         \
+        subtractArraysPacked(dst, src, n);                                                      \
+    }                                                                                           \
+    ARRAY_SIMD_CLONES inline void scaleArray(T* dst, T k, std::size_t n) {                      \
+        scaleArrayPacked(dst, k, n);                                                            \
+    }                                                                                           \
+    ARRAY_SIMD_CLONES inline void addScaledArray(T* dst, T k, const T* src, std::size_t n) {    \
+        addScaledArrayPacked(dst, k, src, n);                                                   \
+    }                                                                                           \
+    ARRAY_SIMD_CLONES inline void multiplyArrays(T* dst, const T* src, std::size_t n) {         \
+        multiplyArraysPacked(dst, src, n);                                                      \
+    }                                                                                           \
+    ARRAY_SIMD_CLONES inline void hornerStepArrays(T* dst, const T* x, T c, std::size_t n) {    \
+        hornerStepArraysPacked(dst, x, c, n);                                                   \
+    }                                                                                           \
+    ARRAY_SIMD_CLONES inline void multiplyAddArrays(T* dst, const T* x, const T* y,             \
+                                                    std::size_t n) {                            \
+        multiplyAddArraysPacked(dst, x, y, n);                                                  \
+    }
+
+ARRAY_KERNEL_OVERLOADS(float)
+ARRAY_KERNEL_OVERLOADS(double)
+ARRAY_KERNEL_OVERLOADS(std::int32_t)
+ARRAY_KERNEL_OVERLOADS(std::int64_t)
+
+#undef ARRAY_KERNEL_OVERLOADS
+
+#endif
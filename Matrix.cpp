@@ -1,22 +1,81 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+#include "ArrayKernels.h"
+#include "ThreadPool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define MATRIX_HAS_MMAP 1
+#endif
+
 using namespace std;
 
-template <typename T>
+// Matrix<T> (both dimensions Dynamic) is sized at run time and stored on the
+// heap; Matrix<T, R, C> is a fixed-size matrix stored inline.
+const size_t Dynamic = 0;
+
+template <typename T, size_t R = Dynamic, size_t C = Dynamic>
 class Matrix;
 
+// View of one row inside the contiguous storage of a Matrix.
+template <typename T>
+class MatrixRow {
+    T* first;
+    size_t length;
+
+public:
+    constexpr MatrixRow(T* first, size_t length) : first(first), length(length) {}
+
+    constexpr T& operator[](size_t j) const {
+        return first[j];
+    }
+
+    constexpr size_t size() const {
+        return length;
+    }
+
+    constexpr T& back() const {
+        return first[length - 1];
+    }
+
+    constexpr T* begin() const {
+        return first;
+    }
+
+    constexpr T* end() const {
+        return first + length;
+    }
+};
+
+
 template <typename T>
 class NonConstMatrixIterator {
-    Matrix<T>& matrix;
-    size_t pos_i, pos_j;
+    T* ptr;
 
 public:
-    NonConstMatrixIterator(Matrix<T>& matrix, size_t pos_i, size_t pos_j)
-            : matrix(matrix), pos_i(pos_i), pos_j(pos_j) {}
+    explicit NonConstMatrixIterator(T* ptr) : ptr(ptr) {}
 
     bool operator == (const NonConstMatrixIterator& other) const {
-        return pos_i == other.pos_i && pos_j == other.pos_j;
+        return ptr == other.ptr;
     }
 
     bool operator != (const NonConstMatrixIterator& other) const {
@@ -24,31 +83,25 @@ public:
     }
 
     NonConstMatrixIterator& operator ++() {
-        ++pos_j;
-        if (pos_j >= matrix.size().second) {
-            ++pos_i;
-            pos_j = 0;
-        }
+        ++ptr;
         return *this;
     }
 
     T& operator *() {
-        return matrix[pos_i][pos_j];
+        return *ptr;
     }
 };
 
 
 template <typename T>
 class ConstMatrixIterator {
-    const Matrix<T>& matrix;
-    size_t pos_i, pos_j;
+    const T* ptr;
 
 public:
-    ConstMatrixIterator(const Matrix<T>& matrix, size_t pos_i, size_t pos_j)
-            : matrix(matrix), pos_i(pos_i), pos_j(pos_j) {}
+    explicit ConstMatrixIterator(const T* ptr) : ptr(ptr) {}
 
     bool operator == (const ConstMatrixIterator& other) const {
-        return pos_i == other.pos_i && pos_j == other.pos_j;
+        return ptr == other.ptr;
     }
 
     bool operator != (const ConstMatrixIterator& other) const {
@@ -56,164 +109,1318 @@ public:
     }
 
     ConstMatrixIterator& operator ++() {
-        ++pos_j;
-        if (pos_j >= matrix.size().second) {
-            ++pos_i;
-            pos_j = 0;
-        }
+        ++ptr;
         return *this;
     }
 
     const T& operator *() const {
-        return matrix[pos_i][pos_j];
+        return *ptr;
     }
 };
 
 
+// True when `x *= k` for an element x of type T gives the same result as
+// `x *= T(k)`, so that the scalar may be converted before scaling.
+template <typename T, typename Num>
+constexpr bool scalesExactly() {
+    if constexpr (is_arithmetic<T>::value && is_arithmetic<Num>::value)
+        return is_same<typename common_type<T, Num>::type, T>::value;
+    else
+        return false;
+}
+
+// Scales n elements starting at dst by k, using the packed kernels when the
+// scalar can be converted to the element type without changing the result.
+template <typename T, typename Num>
+void scaleElements(T* dst, Num k, size_t n) {
+    if constexpr (scalesExactly<T, Num>())
+        scaleArray(dst, static_cast<T>(k), n);
+    else
+        scaleArray(dst, k, n);
+}
+
+// Matrix product kernels. All of them add a * b to c, where a is n x inner,
+// b is inner x m and c is n x m, every operand being a row-major block whose
+// consecutive rows are lda, ldb and ldc elements apart.
+
 template <typename T>
-class Matrix {
-    vector<vector<T>> rows;
+void multiplyClassic(const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+                     size_t n, size_t inner, size_t m) {
+    for (size_t i = 0; i != n; ++i) {
+        T* resultRow = c + i * ldc;
+        const T* leftRow = a + i * lda;
+        for (size_t k = 0; k != inner; ++k) {
+            T factor = leftRow[k];
+            const T* rightRow = b + k * ldb;
+            for (size_t j = 0; j != m; ++j) {
+                resultRow[j] += factor * rightRow[j];
+            }
+        }
+    }
+}
+
+// Register tile and cache panel sizes of the blocked kernel: a packed
+// GEMM_MC x GEMM_KC block of a stays in L2, a GEMM_KC x GEMM_NR sliver of b
+// stays in L1, and the GEMM_MR x GEMM_NR accumulators stay in registers.
+const size_t GEMM_MR = 4, GEMM_NR = 8;
+const size_t GEMM_MC = 64, GEMM_KC = 256, GEMM_NC = 2048;
+
+// Copies a mc x kc block of a into GEMM_MR-row slivers stored column by
+// column, padding the last sliver with zeros.
+template <typename T>
+void packGemmA(const T* a, size_t lda, size_t mc, size_t kc, T* packed) {
+    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+        for (size_t p = 0; p != kc; ++p) {
+            for (size_t i = 0; i != GEMM_MR; ++i) {
+                *packed++ = ir + i < mc ? a[(ir + i) * lda + p] : T(0);
+            }
+        }
+    }
+}
+
+// Copies a kc x nc block of b into GEMM_NR-column slivers stored row by row,
+// padding the last sliver with zeros.
+template <typename T>
+void packGemmB(const T* b, size_t ldb, size_t kc, size_t nc, T* packed) {
+    for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+        for (size_t p = 0; p != kc; ++p) {
+            for (size_t j = 0; j != GEMM_NR; ++j) {
+                *packed++ = jr + j < nc ? b[p * ldb + jr + j] : T(0);
+            }
+        }
+    }
+}
+
+// Multiplies a packed sliver of a by a packed sliver of b and adds the
+// top-left mr x nr corner of the product to c.
+template <typename T>
+void gemmMicroKernel(size_t kc, const T* packedA, const T* packedB,
+                     T* c, size_t ldc, size_t mr, size_t nr) {
+    T acc[GEMM_MR][GEMM_NR] = {};
+    for (size_t p = 0; p != kc; ++p) {
+        for (size_t i = 0; i != GEMM_MR; ++i) {
+            T factor = packedA[i];
+            for (size_t j = 0; j != GEMM_NR; ++j) {
+                acc[i][j] += factor * packedB[j];
+            }
+        }
+        packedA += GEMM_MR;
+        packedB += GEMM_NR;
+    }
+    for (size_t i = 0; i != mr; ++i) {
+        for (size_t j = 0; j != nr; ++j) {
+            c[i * ldc + j] += acc[i][j];
+        }
+    }
+}
+
+template <typename T>
+void multiplyBlocked(const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+                     size_t n, size_t inner, size_t m) {
+    auto roundUp = [](size_t x, size_t step) { return (x + step - 1) / step * step; };
+    vector<T> packedA(roundUp(min(n, GEMM_MC), GEMM_MR) * min(inner, GEMM_KC));
+    vector<T> packedB(min(inner, GEMM_KC) * roundUp(min(m, GEMM_NC), GEMM_NR));
+    for (size_t jc = 0; jc < m; jc += GEMM_NC) {
+        size_t nc = min(GEMM_NC, m - jc);
+        for (size_t pc = 0; pc < inner; pc += GEMM_KC) {
+            size_t kc = min(GEMM_KC, inner - pc);
+            packGemmB(b + pc * ldb + jc, ldb, kc, nc, packedB.data());
+            for (size_t ic = 0; ic < n; ic += GEMM_MC) {
+                size_t mc = min(GEMM_MC, n - ic);
+                packGemmA(a + ic * lda + pc, lda, mc, kc, packedA.data());
+                for (size_t jr = 0; jr < nc; jr += GEMM_NR) {
+                    for (size_t ir = 0; ir < mc; ir += GEMM_MR) {
+                        gemmMicroKernel(kc, packedA.data() + ir * kc, packedB.data() + jr * kc,
+                                        c + (ic + ir) * ldc + jc + jr, ldc,
+                                        min(GEMM_MR, mc - ir), min(GEMM_NR, nc - jr));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Transposition works on GEMM-sized square tiles so that both the rows read
+// and the columns written stay in cache.
+const size_t TRANSPOSE_BLOCK = 32;
+
+// Writes rows [first, last) of the rows x columns matrix src into the
+// matching columns of dst, its columns x rows transpose.
+template <typename T>
+void transposeRows(const T* src, T* dst, size_t rows, size_t columns, size_t first, size_t last) {
+    for (size_t ib = first; ib < last; ib += TRANSPOSE_BLOCK) {
+        size_t iEnd = min(last, ib + TRANSPOSE_BLOCK);
+        for (size_t jb = 0; jb < columns; jb += TRANSPOSE_BLOCK) {
+            size_t jEnd = min(columns, jb + TRANSPOSE_BLOCK);
+            for (size_t i = ib; i != iEnd; ++i) {
+                for (size_t j = jb; j != jEnd; ++j) {
+                    dst[j * rows + i] = src[i * columns + j];
+                }
+            }
+        }
+    }
+}
+
+// Transposes the n x n matrix a in place by swapping mirrored tiles.
+template <typename T>
+void transposeSquareInPlace(T* a, size_t n) {
+    for (size_t ib = 0; ib < n; ib += TRANSPOSE_BLOCK) {
+        size_t iEnd = min(n, ib + TRANSPOSE_BLOCK);
+        for (size_t jb = ib; jb < n; jb += TRANSPOSE_BLOCK) {
+            size_t jEnd = min(n, jb + TRANSPOSE_BLOCK);
+            for (size_t i = ib; i != iEnd; ++i) {
+                for (size_t j = max(jb, i + 1); j < jEnd; ++j) {
+                    swap(a[i * n + j], a[j * n + i]);
+                }
+            }
+        }
+    }
+}
+
+// Transposes the rows x columns matrix a in place by following the cycles
+// of the index permutation. By default a bitmap of one bit per element
+// marks the positions already moved. With boundedMemory set, as for mapped
+// matrices larger than RAM, each cycle is instead moved from its smallest
+// index, recognized by walking the cycle's indices without reading any
+// element; no memory beyond one element is needed, at the price of the
+// extra index walks.
+template <typename T>
+void transposeInPlace(T* a, size_t rows, size_t columns, bool boundedMemory = false) {
+    if (rows == columns) {
+        transposeSquareInPlace(a, rows);
+        return;
+    }
+    // Element (i, j) goes to (j, i) of the columns x rows result.
+    auto next = [rows, columns](size_t pos) {
+        return (pos % columns) * rows + pos / columns;
+    };
+    size_t total = rows * columns;
+    vector<bool> moved(boundedMemory ? 0 : total);
+    for (size_t start = 1; start + 1 < total; ++start) {
+        size_t pos = start;
+        if (boundedMemory) {
+            for (pos = next(start); pos > start; )
+                pos = next(pos);
+            if (pos != start)
+                continue;
+        } else if (moved[start]) {
+            continue;
+        }
+        T carried = std::move(a[start]);
+        do {
+            pos = next(pos);
+            swap(carried, a[pos]);
+            if (!boundedMemory)
+                moved[pos] = true;
+        } while (pos != start);
+    }
+}
+
+// Rectangular matrices up to this many elements are transposed through a
+// temporary buffer, which is faster than following cycles.
+const size_t TRANSPOSE_OUT_OF_PLACE_LIMIT = 1 << 20;
+
+// Strassen-Winograd multiplication: 7 half-size products and 15 block
+// additions per level instead of 8 products. It pays off when multiplying
+// elements costs much more than adding them. Odd dimensions are handled by
+// peeling the last row, column or inner index off with classical products.
+
+// Whether T has everything the block additions need: binary -, -= and
+// construction from 0. Semirings such as min-plus lack it.
+template <typename T, typename = void>
+struct SupportsSubtraction : false_type {};
+
+template <typename T>
+struct SupportsSubtraction<T, void_t<decltype(declval<T>() - declval<T>()),
+                                     decltype(declval<T&>() -= declval<T>()),
+                                     decltype(T(0))>> : true_type {};
+
+// Element types for which the Strassen-Winograd path is chosen
+// automatically; specialize to opt a type in or out. Types without
+// subtraction always get the classical kernel.
+template <typename T>
+struct IsExpensiveElement
+    : integral_constant<bool, !is_arithmetic<T>::value && SupportsSubtraction<T>::value> {};
+
+// Operands with a dimension below this use the classical kernel.
+const size_t STRASSEN_CROSSOVER = 64;
+
+// dst = x + y, or dst = x - y when subtract is set.
+template <typename T>
+void combineBlocks(T* dst, size_t ldd, const T* x, size_t ldx, const T* y, size_t ldy,
+                   size_t rows, size_t columns, bool subtract) {
+    for (size_t i = 0; i != rows; ++i) {
+        for (size_t j = 0; j != columns; ++j) {
+            if (subtract)
+                dst[i * ldd + j] = x[i * ldx + j] - y[i * ldy + j];
+            else
+                dst[i * ldd + j] = x[i * ldx + j] + y[i * ldy + j];
+        }
+    }
+}
+
+// dst += src, or dst -= src when subtract is set.
+template <typename T>
+void accumulateBlock(T* dst, size_t ldd, const T* src, size_t lds,
+                     size_t rows, size_t columns, bool subtract = false) {
+    for (size_t i = 0; i != rows; ++i) {
+        for (size_t j = 0; j != columns; ++j) {
+            if (subtract)
+                dst[i * ldd + j] -= src[i * lds + j];
+            else
+                dst[i * ldd + j] += src[i * lds + j];
+        }
+    }
+}
+
+template <typename T>
+void multiplyStrassen(const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+                      size_t n, size_t inner, size_t m, size_t crossover = STRASSEN_CROSSOVER) {
+    if (min(n, min(inner, m)) < max<size_t>(crossover, 2)) {
+        multiplyClassic(a, lda, b, ldb, c, ldc, n, inner, m);
+        return;
+    }
+    size_t h = n / 2, kh = inner / 2, mh = m / 2;
+    const T *a11 = a, *a12 = a + kh, *a21 = a + h * lda, *a22 = a21 + kh;
+    const T *b11 = b, *b12 = b + mh, *b21 = b + kh * ldb, *b22 = b21 + mh;
+    T *c11 = c, *c12 = c + mh, *c21 = c + h * ldc, *c22 = c21 + mh;
+
+    auto product = [&](const T* x, size_t ldx, const T* y, size_t ldy) {
+        vector<T> result(h * mh, T(0));
+        multiplyStrassen(x, ldx, y, ldy, result.data(), mh, h, kh, mh, crossover);
+        return result;
+    };
+
+    vector<T> s1(h * kh), s2(h * kh), s3(h * kh), s4(h * kh);
+    combineBlocks(s1.data(), kh, a21, lda, a22, lda, h, kh, false);
+    combineBlocks(s2.data(), kh, s1.data(), kh, a11, lda, h, kh, true);
+    combineBlocks(s3.data(), kh, a11, lda, a21, lda, h, kh, true);
+    combineBlocks(s4.data(), kh, a12, lda, s2.data(), kh, h, kh, true);
+    vector<T> t1(kh * mh), t2(kh * mh), t3(kh * mh), t4(kh * mh);
+    combineBlocks(t1.data(), mh, b12, ldb, b11, ldb, kh, mh, true);
+    combineBlocks(t2.data(), mh, b22, ldb, t1.data(), mh, kh, mh, true);
+    combineBlocks(t3.data(), mh, b22, ldb, b12, ldb, kh, mh, true);
+    combineBlocks(t4.data(), mh, t2.data(), mh, b21, ldb, kh, mh, true);
+
+    // C11 += P1 + P2; the running sums U2 = P1 + P6 and U3 = U2 + P7 feed
+    // the other three quadrants.
+    vector<T> u = product(a11, lda, b11, ldb);
+    accumulateBlock(c11, ldc, u.data(), mh, h, mh);
+    accumulateBlock(c11, ldc, product(a12, lda, b21, ldb).data(), mh, h, mh);
+    accumulateBlock(u.data(), mh, product(s2.data(), kh, t2.data(), mh).data(), mh, h, mh);
+    vector<T> u3 = product(s3.data(), kh, t3.data(), mh);
+    accumulateBlock(u3.data(), mh, u.data(), mh, h, mh);
+    vector<T> p5 = product(s1.data(), kh, t1.data(), mh);
+    // C12 += U2 + P5 + P3.
+    accumulateBlock(c12, ldc, u.data(), mh, h, mh);
+    accumulateBlock(c12, ldc, p5.data(), mh, h, mh);
+    accumulateBlock(c12, ldc, product(s4.data(), kh, b22, ldb).data(), mh, h, mh);
+    // C21 += U3 - P4.
+    accumulateBlock(c21, ldc, u3.data(), mh, h, mh);
+    accumulateBlock(c21, ldc, product(a22, lda, t4.data(), mh).data(), mh, h, mh, true);
+    // C22 += U3 + P5.
+    accumulateBlock(c22, ldc, u3.data(), mh, h, mh);
+    accumulateBlock(c22, ldc, p5.data(), mh, h, mh);
+
+    size_t n2 = 2 * h, k2 = 2 * kh, m2 = 2 * mh;
+    if (k2 != inner)
+        multiplyClassic(a + k2, lda, b + k2 * ldb, ldb, c, ldc, n2, 1, m2);
+    if (m2 != m)
+        multiplyClassic(a, lda, b + m2, ldb, c + m2, ldc, n2, inner, 1);
+    if (n2 != n)
+        multiplyClassic(a + n2 * lda, lda, b, ldb, c + n2 * ldc, ldc, 1, inner, m);
+}
+
+// Below this many multiply-adds packing costs more than it saves.
+const size_t GEMM_BLOCKED_THRESHOLD = 32 * 32 * 32;
+
+template <typename T>
+void multiplyAdd(const T* a, size_t lda, const T* b, size_t ldb, T* c, size_t ldc,
+                 size_t n, size_t inner, size_t m) {
+    if constexpr (is_arithmetic<T>::value) {
+        if (n * inner * m >= GEMM_BLOCKED_THRESHOLD) {
+            multiplyBlocked(a, lda, b, ldb, c, ldc, n, inner, m);
+            return;
+        }
+    }
+    if constexpr (IsExpensiveElement<T>::value) {
+        multiplyStrassen(a, lda, b, ldb, c, ldc, n, inner, m);
+        return;
+    }
+    multiplyClassic(a, lda, b, ldb, c, ldc, n, inner, m);
+}
+
+template <typename T>
+void multiplyAdd(const T* a, const T* b, T* c, size_t n, size_t inner, size_t m) {
+    multiplyAdd(a, inner, b, m, c, m, n, inner, m);
+}
+
+// Tag selecting the multi-threaded overloads of the Matrix operations.
+struct ParallelExecution {};
+const ParallelExecution par{};
+
+// Lazy matrix expressions. `a + b * 2 - c.transposed()` builds a tree of
+// lightweight nodes instead of temporary matrices; the tree is evaluated in
+// a single pass when it is assigned to (or used to construct) a Matrix.
+// Matrices inside an expression are held by reference, inner nodes by value,
+// so an expression must not outlive the matrices it was built from.
+//
+// Every node provides value_type, size(), at(i, j), refersTo(target) (the
+// expression reads the matrix at target) and readsMisaligned(target) (it
+// reads an element of that matrix other than the one at the same position,
+// so it cannot be evaluated in place into it).
 
+template <typename E>
+class MatrixTransposed;
+
+template <typename E>
+class MatrixExpression {
 public:
-    Matrix() = default;
+    const E& self() const {
+        return static_cast<const E&>(*this);
+    }
 
-    Matrix(const vector<vector<T>>& rows) {
-        this->rows = rows;
+    MatrixTransposed<E> transposed() const {
+        return MatrixTransposed<E>(self());
+    }
+
+    // The expression evaluated into a new matrix, for element access and
+    // member functions that need storage: (a + b).eval()[i].
+    auto eval() const {
+        return Matrix<typename E::value_type>(self());
+    }
+};
+
+template <typename X>
+struct IsMatrixExpression : is_base_of<MatrixExpression<X>, X> {};
+
+template <typename E>
+struct ExpressionOperand {
+    typedef E type;
+};
+
+template <typename T>
+struct ExpressionOperand<Matrix<T>> {
+    typedef const Matrix<T>& type;
+};
+
+template <typename L, typename R, typename Operation>
+class MatrixElementwise : public MatrixExpression<MatrixElementwise<L, R, Operation>> {
+    typename ExpressionOperand<L>::type left;
+    typename ExpressionOperand<R>::type right;
+
+public:
+    typedef typename L::value_type value_type;
+
+    MatrixElementwise(const L& left, const R& right) : left(left), right(right) {
+        assert(left.size() == right.size());
+    }
+
+    pair<size_t, size_t> size() const {
+        return left.size();
+    }
+
+    value_type at(size_t i, size_t j) const {
+        return Operation()(left.at(i, j), right.at(i, j));
     }
 
-    Matrix(size_t countRows, size_t countColumns) {
-        rows = vector<vector<T>>(countRows, vector<T>(countColumns));
+    bool refersTo(const void* target) const {
+        return left.refersTo(target) || right.refersTo(target);
     }
 
-    explicit Matrix(pair<size_t, size_t> sz) {
-        rows = vector<vector<T>>(sz.first, vector<T>(sz.second));
+    bool readsMisaligned(const void* target) const {
+        return left.readsMisaligned(target) || right.readsMisaligned(target);
     }
+};
+
+template <typename E, typename Num>
+class MatrixScaled : public MatrixExpression<MatrixScaled<E, Num>> {
+    typename ExpressionOperand<E>::type operand;
+    Num k;
+
+public:
+    typedef typename E::value_type value_type;
+
+    MatrixScaled(const E& operand, Num k) : operand(operand), k(k) {}
 
     pair<size_t, size_t> size() const {
-        if (rows.empty())
-            return {0, 0};
-        return {rows.size(), rows[0].size()};
+        return operand.size();
     }
 
-    const vector<T>& operator[](size_t i) const {
-        return rows[i];
+    value_type at(size_t i, size_t j) const {
+        value_type element = operand.at(i, j);
+        element *= k;
+        return element;
     }
 
-    vector<T>& operator[](size_t i) {
-        return rows[i];
+    bool refersTo(const void* target) const {
+        return operand.refersTo(target);
     }
 
-    const vector<T>& back() const {
-        return rows.back();
+    bool readsMisaligned(const void* target) const {
+        return operand.readsMisaligned(target);
     }
+};
 
-    Matrix& operator += (const Matrix& other) {
-        for (size_t i = 0; i != rows.size(); ++i) {
-            for (size_t j = 0; j != rows[i].size(); ++j) {
-                rows[i][j] += other[i][j];
-            }
+template <typename E>
+class MatrixTransposed : public MatrixExpression<MatrixTransposed<E>> {
+    typename ExpressionOperand<E>::type operand;
+
+public:
+    typedef typename E::value_type value_type;
+
+    explicit MatrixTransposed(const E& operand) : operand(operand) {}
+
+    const E& source() const {
+        return operand;
+    }
+
+    pair<size_t, size_t> size() const {
+        pair<size_t, size_t> sz = operand.size();
+        return {sz.second, sz.first};
+    }
+
+    value_type at(size_t i, size_t j) const {
+        return operand.at(j, i);
+    }
+
+    bool refersTo(const void* target) const {
+        return operand.refersTo(target);
+    }
+
+    bool readsMisaligned(const void* target) const {
+        return operand.refersTo(target);
+    }
+};
+
+template <typename L, typename R>
+MatrixElementwise<L, R, plus<>> operator + (const MatrixExpression<L>& left,
+                                             const MatrixExpression<R>& right) {
+    return {left.self(), right.self()};
+}
+
+template <typename L, typename R>
+MatrixElementwise<L, R, minus<>> operator - (const MatrixExpression<L>& left,
+                                              const MatrixExpression<R>& right) {
+    return {left.self(), right.self()};
+}
+
+template <typename E, typename Num,
+          typename = typename enable_if<!IsMatrixExpression<Num>::value>::type>
+MatrixScaled<E, Num> operator * (const MatrixExpression<E>& operand, Num k) {
+    return {operand.self(), k};
+}
+
+// Element buffer of a Matrix: an owned heap array, or a shared read-write
+// mapping of a file for matrices larger than memory. The file holds the
+// elements in the same row-major order, so rows and iterators are plain
+// pointers either way and the blocked kernels stream it tile by tile,
+// letting the kernel page data in and out. Copies are always heap arrays;
+// resizing a mapped buffer copies it to the heap and detaches the file.
+template <typename T>
+class MatrixStorage {
+    vector<T> owned;
+    T* mapped = nullptr;
+    size_t mappedCount = 0;
+
+    void unmap() {
+#ifdef MATRIX_HAS_MMAP
+        if (mapped != nullptr)
+            munmap(mapped, mappedCount * sizeof(T));
+#endif
+        mapped = nullptr;
+        mappedCount = 0;
+    }
+
+public:
+    MatrixStorage() = default;
+
+    explicit MatrixStorage(size_t count) : owned(count) {}
+
+    MatrixStorage(const MatrixStorage& other) : owned(other.begin(), other.end()) {}
+
+    MatrixStorage(MatrixStorage&& other) noexcept {
+        swap(other);
+    }
+
+    MatrixStorage& operator = (const MatrixStorage& other) {
+        if (this != &other) {
+            if (mapped != nullptr && mappedCount == other.size())
+                copy(other.begin(), other.end(), mapped);
+            else
+                *this = MatrixStorage(other);
         }
         return *this;
     }
 
-    Matrix operator + (const Matrix& other) const {
-        Matrix result = *this;
-        for (size_t i = 0; i != rows.size(); ++i) {
-            for (size_t j = 0; j != rows[i].size(); ++j) {
-                result[i][j] += other[i][j];
-            }
+    MatrixStorage& operator = (MatrixStorage&& other) noexcept {
+        MatrixStorage(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~MatrixStorage() {
+        unmap();
+    }
+
+    void swap(MatrixStorage& other) noexcept {
+        owned.swap(other.owned);
+        std::swap(mapped, other.mapped);
+        std::swap(mappedCount, other.mappedCount);
+    }
+
+    // Maps count elements of the file at path, creating or extending it
+    // when needed.
+    static MatrixStorage mapFile(const string& path, size_t count) {
+        static_assert(is_trivially_copyable<T>::value, "only trivially copyable elements can be mapped");
+        MatrixStorage result;
+#ifdef MATRIX_HAS_MMAP
+        if (count == 0)
+            return result;
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path);
+        off_t bytes = static_cast<off_t>(count * sizeof(T));
+        off_t current = lseek(fd, 0, SEEK_END);
+        if (current < bytes && ftruncate(fd, bytes) != 0) {
+            close(fd);
+            throw std::runtime_error("cannot resize " + path);
         }
+        void* address = mmap(nullptr, count * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED)
+            throw std::runtime_error("cannot map " + path);
+        result.mapped = static_cast<T*>(address);
+        result.mappedCount = count;
+#else
+        (void)path;
+        (void)count;
+        throw std::runtime_error("memory-mapped matrices are not supported on this platform");
+#endif
         return result;
     }
 
-    template <typename Num>
-    Matrix& operator *= (Num k) {
-        for (size_t i = 0; i != rows.size(); ++i) {
-            for (size_t j = 0; j != rows[i].size(); ++j) {
-                rows[i][j] *= k;
-            }
+    bool isMapped() const {
+        return mapped != nullptr;
+    }
+
+    // Writes modified pages of a mapped buffer back to its file.
+    void flush() {
+#ifdef MATRIX_HAS_MMAP
+        if (mapped != nullptr)
+            msync(mapped, mappedCount * sizeof(T), MS_SYNC);
+#endif
+    }
+
+    void resize(size_t count) {
+        if (mapped == nullptr) {
+            owned.resize(count);
+        } else if (count != mappedCount) {
+            vector<T> copied(mapped, mapped + min(count, mappedCount));
+            copied.resize(count);
+            unmap();
+            owned.swap(copied);
         }
-        return *this;
     }
 
-    template <typename Num>
-    Matrix operator * (Num k) const {
-        Matrix result = *this;
-        result *= k;
-        return result;
+    size_t size() const {
+        return mapped != nullptr ? mappedCount : owned.size();
     }
 
-    Matrix& transpose() {
-        vector<vector<T>> newRows(size().second, vector<T>(size().first));
-        for (size_t i = 0; i != rows.size(); ++i) {
-            for (size_t j = 0; j != rows[i].size(); ++j) {
-                newRows[j][i] = rows[i][j];
+    T* data() {
+        return mapped != nullptr ? mapped : owned.data();
+    }
+
+    const T* data() const {
+        return mapped != nullptr ? mapped : owned.data();
+    }
+
+    T& operator[](size_t k) {
+        return data()[k];
+    }
+
+    const T& operator[](size_t k) const {
+        return data()[k];
+    }
+
+    T* begin() {
+        return data();
+    }
+
+    T* end() {
+        return data() + size();
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size();
+    }
+};
+
+// Elements are kept in a single row-major buffer: element (i, j) lives at
+// elements[i * countColumns + j].
+template <typename T>
+class Matrix<T, Dynamic, Dynamic> : public MatrixExpression<Matrix<T>> {
+    size_t countRows = 0, countColumns = 0;
+    MatrixStorage<T> elements;
+
+    template <typename E>
+    void evaluate(const E& expression) {
+        pair<size_t, size_t> sz = expression.size();
+        countRows = sz.first;
+        countColumns = sz.second;
+        elements.resize(countRows * countColumns);
+        T* dst = elements.data();
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j) {
+                *dst++ = expression.at(i, j);
             }
         }
-        rows = newRows;
+    }
+
+    // Takes over the elements of result. A mapped buffer of the same size
+    // keeps its file and receives a copy instead, as a shape-preserving
+    // assignment to a mapped matrix must not move it onto the heap.
+    Matrix& assignResult(Matrix&& result) {
+        countRows = result.countRows;
+        countColumns = result.countColumns;
+        if (elements.isMapped() && elements.size() == result.elements.size())
+            copy(result.elements.begin(), result.elements.end(), elements.begin());
+        else
+            elements = std::move(result.elements);
         return *this;
     }
 
-    Matrix transposed() const {
-        vector<vector<T>> newRows(size().second, vector<T>(size().first));
-        for (size_t i = 0; i != rows.size(); ++i) {
-            for (size_t j = 0; j != rows[i].size(); ++j) {
-                newRows[j][i] = rows[i][j];
-            }
+public:
+    typedef T value_type;
+
+    Matrix() = default;
+
+    Matrix(const vector<vector<T>>& rows) {
+        countRows = rows.size();
+        countColumns = rows.empty() ? 0 : rows[0].size();
+        elements.resize(countRows * countColumns);
+        for (size_t i = 0; i != countRows; ++i) {
+            assert(rows[i].size() == countColumns);
+            copy(rows[i].begin(), rows[i].end(), elements.data() + i * countColumns);
         }
-        return Matrix(newRows);
     }
 
-    Matrix& operator *= (const Matrix& other) {
-        assert(size().second == other.size().first);
-        vector<vector<T>> newRows(size().first, vector<T>(other.size().second));
-        for (size_t i = 0; i != newRows.size(); ++i) {
-            for (size_t k = 0; k != size().second; ++k) {
-                for (size_t j = 0; j != newRows[i].size(); ++j) {
-                    newRows[i][j] += rows[i][k] * other[k][j];
-                }
-            }
-        }
-        rows = newRows;
-        return *this;
+    Matrix(size_t countRows, size_t countColumns)
+            : countRows(countRows),
+              countColumns(countRows == 0 ? 0 : countColumns),
+              elements(this->countRows * this->countColumns) {}
+
+    explicit Matrix(pair<size_t, size_t> sz) : Matrix(sz.first, sz.second) {}
+
+    template <typename E>
+    Matrix(const MatrixExpression<E>& expression) {
+        evaluate(expression.self());
     }
 
-    Matrix operator * (const Matrix& other) const {
-        Matrix result = *this;
-        result *= other;
-        return result;
+    Matrix(const MatrixTransposed<Matrix>& expression) : Matrix(expression.size()) {
+        const Matrix& source = expression.source();
+        transposeRows(source.elements.data(), elements.data(),
+                      source.countRows, source.countColumns, 0, source.countRows);
     }
 
-    const ConstMatrixIterator<T> begin() const {
-        return {*this, 0, 0};
+    // Matrix whose elements live in the file at path (see MatrixStorage).
+    // Existing contents of the file are kept; new files start zeroed.
+    static Matrix mapFile(const string& path, size_t countRows, size_t countColumns) {
+        Matrix result;
+        result.countRows = countRows;
+        result.countColumns = countRows == 0 ? 0 : countColumns;
+        result.elements = MatrixStorage<T>::mapFile(path, result.countRows * result.countColumns);
+        return result;
     }
 
-    NonConstMatrixIterator<T> begin() {
-        return {*this, 0, 0};
+    bool isMapped() const {
+        return elements.isMapped();
     }
 
-    const ConstMatrixIterator<T> end() const {
-        if (size().first == 0 || size().second == 0)
-            return begin();
-        return {*this, size().first, 0};
+    void flush() {
+        elements.flush();
     }
 
-    NonConstMatrixIterator<T> end() {
-        if (size().first == 0 || size().second == 0)
-            return begin();
-        return {*this, size().first, 0};
+    Matrix(const Matrix&) = default;
+    Matrix& operator = (const Matrix&) = default;
+
+    // A moved-from matrix is left as a valid 0x0 matrix.
+    Matrix(Matrix&& other) noexcept
+            : countRows(other.countRows), countColumns(other.countColumns),
+              elements(std::move(other.elements)) {
+        other.countRows = other.countColumns = 0;
     }
-};
 
-template <typename T>
-ostream& operator <<(ostream& out, const Matrix<T>& matrix) {
-    if (matrix.size().first != 0 && matrix.size().second != 0) {
-        for (size_t i = 0; i + 1 != matrix.size().first; ++i) {
-            for (size_t j = 0; j + 1 != matrix.size().second; ++j)
-                out << matrix[i][j] << "\t";
-            out << matrix[i].back() << "\n";
+    // Like copy assignment, moving into a mapped matrix of the same size
+    // writes through to its file.
+    Matrix& operator = (Matrix&& other) noexcept {
+        if (this != &other) {
+            assignResult(std::move(other));
+            other.countRows = other.countColumns = 0;
+            other.elements = MatrixStorage<T>();
         }
-        for (size_t j = 0; j + 1 != matrix.size().second; ++j)
+        return *this;
+    }
+
+    template <typename E>
+    Matrix& operator = (const MatrixExpression<E>& expression) {
+        if (expression.self().readsMisaligned(this))
+            return assignResult(Matrix(expression.self()));
+        evaluate(expression.self());
+        return *this;
+    }
+
+    Matrix& operator = (const MatrixTransposed<Matrix>& expression) {
+        const Matrix& source = expression.source();
+        if (&source == this)
+            return transpose();
+        if (elements.isMapped() && elements.size() == source.elements.size()) {
+            countRows = source.countColumns;
+            countColumns = source.countRows;
+            transposeRows(source.elements.data(), elements.data(), source.countRows,
+                          source.countColumns, 0, source.countRows);
+            return *this;
+        }
+        return *this = Matrix(expression);
+    }
+
+    pair<size_t, size_t> size() const {
+        return {countRows, countColumns};
+    }
+
+    const T* data() const {
+        return elements.data();
+    }
+
+    T* data() {
+        return elements.data();
+    }
+
+    MatrixRow<const T> operator[](size_t i) const {
+        return {elements.data() + i * countColumns, countColumns};
+    }
+
+    MatrixRow<T> operator[](size_t i) {
+        return {elements.data() + i * countColumns, countColumns};
+    }
+
+    MatrixRow<const T> back() const {
+        return (*this)[countRows - 1];
+    }
+
+    const T& at(size_t i, size_t j) const {
+        return elements[i * countColumns + j];
+    }
+
+    bool refersTo(const void* target) const {
+        return this == target;
+    }
+
+    bool readsMisaligned(const void*) const {
+        return false;
+    }
+
+    Matrix& operator += (const Matrix& other) {
+        assert(size() == other.size());
+        addArrays(elements.data(), other.elements.data(), elements.size());
+        return *this;
+    }
+
+    template <typename E>
+    Matrix& operator += (const MatrixExpression<E>& expression) {
+        const E& other = expression.self();
+        assert(size() == other.size());
+        if (other.readsMisaligned(this))
+            return *this += Matrix(other);
+        T* dst = elements.data();
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j) {
+                *dst++ += other.at(i, j);
+            }
+        }
+        return *this;
+    }
+
+    template <typename E>
+    Matrix& operator -= (const MatrixExpression<E>& expression) {
+        const E& other = expression.self();
+        assert(size() == other.size());
+        if (other.readsMisaligned(this))
+            return *this -= Matrix(other);
+        T* dst = elements.data();
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j) {
+                *dst++ -= other.at(i, j);
+            }
+        }
+        return *this;
+    }
+
+    template <typename Num,
+              typename = typename enable_if<!IsMatrixExpression<Num>::value>::type>
+    Matrix& operator *= (Num k) {
+        scaleElements(elements.data(), k, elements.size());
+        return *this;
+    }
+
+    // Square matrices, large rectangular ones and mapped ones are transposed
+    // without a second buffer.
+    Matrix& transpose() {
+        if (countRows != countColumns && elements.size() <= TRANSPOSE_OUT_OF_PLACE_LIMIT &&
+                !elements.isMapped())
+            return *this = Matrix(this->transposed());
+        transposeInPlace(elements.data(), countRows, countColumns, elements.isMapped());
+        swap(countRows, countColumns);
+        return *this;
+    }
+
+    Matrix& operator *= (const Matrix& other) {
+        assert(countColumns == other.countRows);
+        // A mapped matrix multiplied by a square one is rewritten a stripe of
+        // rows at a time, each row of the product depending only on the same
+        // row of this matrix, so the scratch space stays at one stripe.
+        if (elements.isMapped() && other.countColumns == countColumns && &other != this) {
+            vector<T> stripe(GEMM_MC * countColumns);
+            for (size_t first = 0; first < countRows; first += GEMM_MC) {
+                size_t rows = min(GEMM_MC, countRows - first);
+                T* row = elements.data() + first * countColumns;
+                fill(stripe.begin(), stripe.end(), T());
+                multiplyAdd(row, other.elements.data(), stripe.data(), rows, countColumns,
+                            countColumns);
+                copy(stripe.begin(), stripe.begin() + rows * countColumns, row);
+            }
+            return *this;
+        }
+        Matrix result(countRows, other.countColumns);
+        multiplyAdd(elements.data(), other.elements.data(), result.elements.data(),
+                    countRows, countColumns, other.countColumns);
+        return assignResult(std::move(result));
+    }
+
+    const ConstMatrixIterator<T> begin() const {
+        return ConstMatrixIterator<T>(elements.data());
+    }
+
+    NonConstMatrixIterator<T> begin() {
+        return NonConstMatrixIterator<T>(elements.data());
+    }
+
+    const ConstMatrixIterator<T> end() const {
+        return ConstMatrixIterator<T>(elements.data() + elements.size());
+    }
+
+    NonConstMatrixIterator<T> end() {
+        return NonConstMatrixIterator<T>(elements.data() + elements.size());
+    }
+};
+
+// Fixed-size R x C matrix. Elements live in a std::array, so small matrices
+// stay on the stack, every operation is constexpr, and the product is
+// expanded at compile time into straight-line multiply-adds.
+template <typename T, size_t R, size_t C>
+class Matrix {
+    static_assert(R != Dynamic && C != Dynamic, "mixed fixed and dynamic sizes are not supported");
+
+    template <typename, size_t, size_t>
+    friend class Matrix;
+
+    array<T, R * C> elements{};
+
+    template <size_t K, size_t... Inner>
+    constexpr T dot(size_t i, size_t j, const Matrix<T, C, K>& other,
+                    index_sequence<Inner...>) const {
+        return (T(0) + ... + (elements[i * C + Inner] * other.elements[Inner * K + j]));
+    }
+
+    template <size_t K, size_t... Index>
+    constexpr Matrix<T, R, K> multiplied(const Matrix<T, C, K>& other,
+                                         index_sequence<Index...>) const {
+        Matrix<T, R, K> result;
+        ((result.elements[Index] = dot(Index / K, Index % K, other, make_index_sequence<C>())), ...);
+        return result;
+    }
+
+public:
+    typedef T value_type;
+
+    constexpr Matrix() = default;
+
+    constexpr Matrix(const T (&rows)[R][C]) {
+        for (size_t i = 0; i != R; ++i) {
+            for (size_t j = 0; j != C; ++j)
+                elements[i * C + j] = rows[i][j];
+        }
+    }
+
+    explicit operator Matrix<T>() const {
+        Matrix<T> result(R, C);
+        copy(elements.begin(), elements.end(), result.data());
+        return result;
+    }
+
+    static constexpr pair<size_t, size_t> size() {
+        return {R, C};
+    }
+
+    constexpr const T* data() const {
+        return elements.data();
+    }
+
+    constexpr T* data() {
+        return elements.data();
+    }
+
+    constexpr MatrixRow<const T> operator[](size_t i) const {
+        return {elements.data() + i * C, C};
+    }
+
+    constexpr MatrixRow<T> operator[](size_t i) {
+        return {elements.data() + i * C, C};
+    }
+
+    constexpr MatrixRow<const T> back() const {
+        return (*this)[R - 1];
+    }
+
+    constexpr const T& at(size_t i, size_t j) const {
+        return elements[i * C + j];
+    }
+
+    constexpr Matrix& operator += (const Matrix& other) {
+        for (size_t k = 0; k != R * C; ++k)
+            elements[k] += other.elements[k];
+        return *this;
+    }
+
+    constexpr Matrix& operator -= (const Matrix& other) {
+        for (size_t k = 0; k != R * C; ++k)
+            elements[k] -= other.elements[k];
+        return *this;
+    }
+
+    constexpr Matrix operator + (const Matrix& other) const {
+        Matrix result = *this;
+        result += other;
+        return result;
+    }
+
+    constexpr Matrix operator - (const Matrix& other) const {
+        Matrix result = *this;
+        result -= other;
+        return result;
+    }
+
+    template <typename Num>
+    constexpr Matrix& operator *= (Num k) {
+        for (T& element : elements)
+            element *= k;
+        return *this;
+    }
+
+    template <typename Num>
+    constexpr Matrix operator * (Num k) const {
+        Matrix result = *this;
+        result *= k;
+        return result;
+    }
+
+    template <size_t K>
+    constexpr Matrix<T, R, K> operator * (const Matrix<T, C, K>& other) const {
+        return multiplied(other, make_index_sequence<R * K>());
+    }
+
+    constexpr Matrix& operator *= (const Matrix<T, C, C>& other) {
+        return *this = *this * other;
+    }
+
+    constexpr Matrix<T, C, R> transposed() const {
+        Matrix<T, C, R> result;
+        for (size_t i = 0; i != R; ++i) {
+            for (size_t j = 0; j != C; ++j)
+                result.elements[j * R + i] = elements[i * C + j];
+        }
+        return result;
+    }
+
+    constexpr Matrix& transpose() {
+        static_assert(R == C, "only square fixed-size matrices can be transposed in place");
+        for (size_t i = 0; i != R; ++i) {
+            for (size_t j = i + 1; j != C; ++j) {
+                T element = elements[i * C + j];
+                elements[i * C + j] = elements[j * C + i];
+                elements[j * C + i] = element;
+            }
+        }
+        return *this;
+    }
+
+    constexpr bool operator == (const Matrix& other) const {
+        for (size_t k = 0; k != R * C; ++k) {
+            if (!(elements[k] == other.elements[k]))
+                return false;
+        }
+        return true;
+    }
+
+    constexpr bool operator != (const Matrix& other) const {
+        return !(*this == other);
+    }
+
+    const ConstMatrixIterator<T> begin() const {
+        return ConstMatrixIterator<T>(elements.data());
+    }
+
+    NonConstMatrixIterator<T> begin() {
+        return NonConstMatrixIterator<T>(elements.data());
+    }
+
+    const ConstMatrixIterator<T> end() const {
+        return ConstMatrixIterator<T>(elements.data() + R * C);
+    }
+
+    NonConstMatrixIterator<T> end() {
+        return NonConstMatrixIterator<T>(elements.data() + R * C);
+    }
+};
+
+// Matrix products are not elementwise, so both operands are evaluated first.
+template <typename L, typename R>
+Matrix<typename L::value_type> operator * (const MatrixExpression<L>& left,
+                                           const MatrixExpression<R>& right) {
+    Matrix<typename L::value_type> result(left.self());
+    result *= right.self();
+    return result;
+}
+
+// Multi-threaded counterparts of the Matrix operators. Every element of the
+// result is computed by exactly one thread in the same order as the serial
+// version, so the results are identical to it for any element type.
+
+const size_t PARALLEL_ELEMENTWISE_GRAIN = 1 << 15;
+
+template <typename T>
+Matrix<T>& addTo(Matrix<T>& matrix, const Matrix<T>& other, ParallelExecution) {
+    assert(matrix.size() == other.size());
+    T* dst = matrix.data();
+    const T* src = other.data();
+    parallelRanges(matrix.size().first * matrix.size().second, PARALLEL_ELEMENTWISE_GRAIN,
+                   [&](size_t first, size_t last) {
+        addArrays(dst + first, src + first, last - first);
+    });
+    return matrix;
+}
+
+template <typename T, typename Num>
+Matrix<T>& scale(Matrix<T>& matrix, Num k, ParallelExecution) {
+    T* dst = matrix.data();
+    parallelRanges(matrix.size().first * matrix.size().second, PARALLEL_ELEMENTWISE_GRAIN,
+                   [&](size_t first, size_t last) {
+        scaleElements(dst + first, k, last - first);
+    });
+    return matrix;
+}
+
+template <typename T>
+Matrix<T> transposed(const Matrix<T>& matrix, ParallelExecution) {
+    size_t rows = matrix.size().first, columns = matrix.size().second;
+    Matrix<T> result(columns, rows);
+    parallelRanges(rows, max<size_t>(1, PARALLEL_ELEMENTWISE_GRAIN / max<size_t>(1, columns)),
+                   [&](size_t first, size_t last) {
+        transposeRows(matrix.data(), result.data(), rows, columns, first, last);
+    });
+    return result;
+}
+
+template <typename T>
+Matrix<T> multiply(const Matrix<T>& a, const Matrix<T>& b, ParallelExecution) {
+    assert(a.size().second == b.size().first);
+    size_t n = a.size().first, inner = a.size().second, m = b.size().second;
+    Matrix<T> result(n, m);
+    // Each thread owns whole GEMM_MC-row stripes of the result.
+    size_t stripes = (n + GEMM_MC - 1) / GEMM_MC;
+    parallelRanges(stripes, 1, [&](size_t first, size_t last) {
+        size_t rowFirst = first * GEMM_MC, rowLast = min(n, last * GEMM_MC);
+        multiplyAdd(a.data() + rowFirst * inner, b.data(), result.data() + rowFirst * m,
+                    rowLast - rowFirst, inner, m);
+    });
+    return result;
+}
+
+// Out-of-core friendly products and transposes: the result is written into
+// an existing matrix of the right shape (typically a mapped one) instead of
+// a new heap buffer, one tile at a time.
+
+template <typename T>
+Matrix<T>& multiplyInto(const Matrix<T>& a, const Matrix<T>& b, Matrix<T>& result) {
+    assert(a.size().second == b.size().first);
+    assert(result.size() == make_pair(a.size().first, b.size().second));
+    assert(&result != &a && &result != &b);
+    fill(result.data(), result.data() + result.size().first * result.size().second, T(0));
+    multiplyAdd(a.data(), b.data(), result.data(), a.size().first, a.size().second, b.size().second);
+    return result;
+}
+
+template <typename T>
+Matrix<T>& transposeInto(const Matrix<T>& source, Matrix<T>& result) {
+    size_t rows = source.size().first, columns = source.size().second;
+    assert(result.size() == make_pair(columns, rows));
+    assert(&result != &source);
+    transposeRows(source.data(), result.data(), rows, columns, 0, rows);
+    return result;
+}
+
+// A batch of same-shaped small matrices in structure-of-arrays layout:
+// element (i, j) of every matrix is stored contiguously, so that element
+// (i, j) of matrix b lives at data()[(i * columns + j) * count + b]. Batch
+// operations run the same scalar step across all matrices at once, which
+// turns the batch dimension into the SIMD dimension.
+template <typename T>
+class MatrixBatch {
+    size_t countRows = 0, countColumns = 0, count = 0;
+    vector<T> elements;
+
+    // Matrices are processed this many at a time so that the slices touched
+    // by one product stay in L1.
+    static const size_t CHUNK = 256;
+
+public:
+    MatrixBatch() = default;
+
+    MatrixBatch(size_t countRows, size_t countColumns, size_t count)
+            : countRows(countRows), countColumns(countColumns), count(count),
+              elements(countRows * countColumns * count) {}
+
+    explicit MatrixBatch(const vector<Matrix<T>>& matrices)
+            : MatrixBatch(matrices.empty() ? 0 : matrices[0].size().first,
+                          matrices.empty() ? 0 : matrices[0].size().second, matrices.size()) {
+        for (size_t b = 0; b != count; ++b)
+            set(b, matrices[b]);
+    }
+
+    pair<size_t, size_t> size() const {
+        return {countRows, countColumns};
+    }
+
+    size_t batchSize() const {
+        return count;
+    }
+
+    const T* data() const {
+        return elements.data();
+    }
+
+    T* data() {
+        return elements.data();
+    }
+
+    // Element (i, j) of every matrix in the batch.
+    const T* slice(size_t i, size_t j) const {
+        return elements.data() + (i * countColumns + j) * count;
+    }
+
+    T* slice(size_t i, size_t j) {
+        return elements.data() + (i * countColumns + j) * count;
+    }
+
+    const T& at(size_t b, size_t i, size_t j) const {
+        return slice(i, j)[b];
+    }
+
+    T& at(size_t b, size_t i, size_t j) {
+        return slice(i, j)[b];
+    }
+
+    Matrix<T> get(size_t b) const {
+        Matrix<T> result(countRows, countColumns);
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j)
+                result[i][j] = at(b, i, j);
+        }
+        return result;
+    }
+
+    void set(size_t b, const Matrix<T>& matrix) {
+        assert(matrix.size() == size());
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j)
+                at(b, i, j) = matrix[i][j];
+        }
+    }
+
+    MatrixBatch& operator += (const MatrixBatch& other) {
+        assert(size() == other.size() && count == other.count);
+        addArrays(elements.data(), other.elements.data(), elements.size());
+        return *this;
+    }
+
+    MatrixBatch operator + (const MatrixBatch& other) const {
+        MatrixBatch result = *this;
+        result += other;
+        return result;
+    }
+
+    template <typename Num>
+    MatrixBatch& operator *= (Num k) {
+        scaleElements(elements.data(), k, elements.size());
+        return *this;
+    }
+
+    template <typename Num>
+    MatrixBatch operator * (Num k) const {
+        MatrixBatch result = *this;
+        result *= k;
+        return result;
+    }
+
+    // Multiplies every matrix of this batch by the matrix at the same index
+    // of other.
+    MatrixBatch operator * (const MatrixBatch& other) const {
+        assert(countColumns == other.countRows && count == other.count);
+        MatrixBatch result(countRows, other.countColumns, count);
+        for (size_t first = 0; first < count; first += CHUNK) {
+            size_t length = min(CHUNK, count - first);
+            for (size_t i = 0; i != countRows; ++i) {
+                for (size_t j = 0; j != other.countColumns; ++j) {
+                    T* dst = result.slice(i, j) + first;
+                    for (size_t k = 0; k != countColumns; ++k)
+                        multiplyAddArrays(dst, slice(i, k) + first, other.slice(k, j) + first, length);
+                }
+            }
+        }
+        return result;
+    }
+
+    MatrixBatch& operator *= (const MatrixBatch& other) {
+        return *this = *this * other;
+    }
+
+    // Transposing only moves whole slices.
+    MatrixBatch transposed() const {
+        MatrixBatch result(countColumns, countRows, count);
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j)
+                copy(slice(i, j), slice(i, j) + count, result.slice(j, i));
+        }
+        return result;
+    }
+
+    MatrixBatch& transpose() {
+        return *this = transposed();
+    }
+};
+
+template <typename T>
+ostream& operator <<(ostream& out, const Matrix<T>& matrix) {
+    if (matrix.size().first != 0 && matrix.size().second != 0) {
+        for (size_t i = 0; i + 1 != matrix.size().first; ++i) {
+            for (size_t j = 0; j + 1 != matrix.size().second; ++j)
+                out << matrix[i][j] << "\t";
+            out << matrix[i].back() << "\n";
+        }
+        for (size_t j = 0; j + 1 != matrix.size().second; ++j)
             out << matrix.back()[j] << "\t";
         out << matrix.back().back();
     } else if (matrix.size().first != 0) {
@@ -222,3 +1429,753 @@ ostream& operator <<(ostream& out, const Matrix<T>& matrix) {
     }
     return out;
 }
+
+template <typename T, size_t R, size_t C>
+ostream& operator <<(ostream& out, const Matrix<T, R, C>& matrix) {
+    return out << Matrix<T>(matrix);
+}
+
+template <typename E>
+ostream& operator <<(ostream& out, const MatrixExpression<E>& expression) {
+    return out << Matrix<typename E::value_type>(expression.self());
+}
+
+
+// Compressed sparse matrix. In the CSR layout the values of row i are
+// values[offsets[i] .. offsets[i + 1]) and indices holds their columns; the
+// CSC layout is the same with the roles of rows and columns swapped.
+// Indices are sorted within every row (column) and no zeros are stored.
+enum class SparseLayout { CSR, CSC };
+
+template <typename T>
+class SparseMatrix {
+    size_t countRows = 0, countColumns = 0;
+    SparseLayout order = SparseLayout::CSR;
+    vector<size_t> offsets{0};
+    vector<size_t> indices;
+    vector<T> values;
+
+    size_t countOuter() const {
+        return order == SparseLayout::CSR ? countRows : countColumns;
+    }
+
+    size_t countInner() const {
+        return order == SparseLayout::CSR ? countColumns : countRows;
+    }
+
+    // Same matrix in the other layout (a counting sort by inner index).
+    SparseMatrix flipped() const {
+        SparseMatrix result;
+        result.countRows = countRows;
+        result.countColumns = countColumns;
+        result.order = order == SparseLayout::CSR ? SparseLayout::CSC : SparseLayout::CSR;
+        result.offsets.assign(countInner() + 1, 0);
+        for (size_t index : indices)
+            ++result.offsets[index + 1];
+        for (size_t i = 0; i != countInner(); ++i)
+            result.offsets[i + 1] += result.offsets[i];
+        result.indices.resize(indices.size());
+        result.values.resize(values.size());
+        vector<size_t> fill(result.offsets.begin(), result.offsets.end() - 1);
+        for (size_t outer = 0; outer != countOuter(); ++outer) {
+            for (size_t k = offsets[outer]; k != offsets[outer + 1]; ++k) {
+                size_t pos = fill[indices[k]]++;
+                result.indices[pos] = outer;
+                result.values[pos] = values[k];
+            }
+        }
+        return result;
+    }
+
+public:
+    SparseMatrix() = default;
+
+    SparseMatrix(size_t countRows, size_t countColumns, SparseLayout layout = SparseLayout::CSR)
+            : countRows(countRows), countColumns(countColumns), order(layout),
+              offsets(countOuter() + 1, 0) {}
+
+    explicit SparseMatrix(const Matrix<T>& dense, SparseLayout layout = SparseLayout::CSR)
+            : countRows(dense.size().first), countColumns(dense.size().second) {
+        T zero(0);
+        offsets.reserve(countRows + 1);
+        for (size_t i = 0; i != countRows; ++i) {
+            for (size_t j = 0; j != countColumns; ++j) {
+                if (dense[i][j] != zero) {
+                    indices.push_back(j);
+                    values.push_back(dense[i][j]);
+                }
+            }
+            offsets.push_back(indices.size());
+        }
+        if (layout == SparseLayout::CSC)
+            *this = flipped();
+    }
+
+    // Builds the matrix from (row, column, value) entries given in any order;
+    // values sharing a position are summed.
+    SparseMatrix(size_t countRows, size_t countColumns, vector<tuple<size_t, size_t, T>> entries,
+                 SparseLayout layout = SparseLayout::CSR)
+            : SparseMatrix(countRows, countColumns, SparseLayout::CSR) {
+        sort(entries.begin(), entries.end(), [](const tuple<size_t, size_t, T>& a,
+                                                const tuple<size_t, size_t, T>& b) {
+            return make_pair(get<0>(a), get<1>(a)) < make_pair(get<0>(b), get<1>(b));
+        });
+        T zero(0);
+        for (size_t k = 0; k != entries.size(); ) {
+            size_t i = get<0>(entries[k]), j = get<1>(entries[k]);
+            assert(i < countRows && j < countColumns);
+            T sum = get<2>(entries[k]);
+            for (++k; k != entries.size() && get<0>(entries[k]) == i && get<1>(entries[k]) == j; ++k)
+                sum += get<2>(entries[k]);
+            if (sum != zero) {
+                indices.push_back(j);
+                values.push_back(sum);
+                ++offsets[i + 1];
+            }
+        }
+        for (size_t i = 0; i != countRows; ++i)
+            offsets[i + 1] += offsets[i];
+        if (layout == SparseLayout::CSC)
+            *this = flipped();
+    }
+
+    pair<size_t, size_t> size() const {
+        return {countRows, countColumns};
+    }
+
+    size_t nonZeros() const {
+        return values.size();
+    }
+
+    SparseLayout layout() const {
+        return order;
+    }
+
+    const vector<size_t>& outerOffsets() const {
+        return offsets;
+    }
+
+    const vector<size_t>& innerIndices() const {
+        return indices;
+    }
+
+    const vector<T>& storedValues() const {
+        return values;
+    }
+
+    T at(size_t i, size_t j) const {
+        size_t outer = i, inner = j;
+        if (order == SparseLayout::CSC)
+            swap(outer, inner);
+        auto first = indices.begin() + offsets[outer], last = indices.begin() + offsets[outer + 1];
+        auto it = lower_bound(first, last, inner);
+        if (it == last || *it != inner)
+            return T(0);
+        return values[it - indices.begin()];
+    }
+
+    SparseMatrix withLayout(SparseLayout layout) const {
+        return layout == order ? *this : flipped();
+    }
+
+    // The CSR arrays of a matrix are the CSC arrays of its transpose, so this
+    // only relabels them.
+    SparseMatrix transposed() const {
+        SparseMatrix result = *this;
+        swap(result.countRows, result.countColumns);
+        result.order = order == SparseLayout::CSR ? SparseLayout::CSC : SparseLayout::CSR;
+        return result;
+    }
+
+    Matrix<T> toDense() const {
+        Matrix<T> result(countRows, countColumns);
+        for (size_t outer = 0; outer != countOuter(); ++outer) {
+            for (size_t k = offsets[outer]; k != offsets[outer + 1]; ++k) {
+                if (order == SparseLayout::CSR)
+                    result[outer][indices[k]] = values[k];
+                else
+                    result[indices[k]][outer] = values[k];
+            }
+        }
+        return result;
+    }
+
+    template <typename Num,
+              typename = typename enable_if<!IsMatrixExpression<Num>::value>::type>
+    SparseMatrix& operator *= (Num k) {
+        scaleElements(values.data(), k, values.size());
+        return *this;
+    }
+
+    template <typename Num,
+              typename = typename enable_if<!IsMatrixExpression<Num>::value>::type>
+    SparseMatrix operator * (Num k) const {
+        SparseMatrix result = *this;
+        result *= k;
+        return result;
+    }
+
+    // Adds this * x to y, restricted to the outer slices [first, last).
+    void multiplyAddVector(const T* x, T* y, size_t first, size_t last) const {
+        for (size_t outer = first; outer != last; ++outer) {
+            if (order == SparseLayout::CSR) {
+                T sum = y[outer];
+                for (size_t k = offsets[outer]; k != offsets[outer + 1]; ++k)
+                    sum += values[k] * x[indices[k]];
+                y[outer] = sum;
+            } else {
+                T factor = x[outer];
+                for (size_t k = offsets[outer]; k != offsets[outer + 1]; ++k)
+                    y[indices[k]] += values[k] * factor;
+            }
+        }
+    }
+
+    // Adds this * dense to result (both row-major with width columns),
+    // restricted to the outer slices [first, last).
+    void multiplyAddDense(const T* dense, T* result, size_t width, size_t first, size_t last) const {
+        for (size_t outer = first; outer != last; ++outer) {
+            for (size_t k = offsets[outer]; k != offsets[outer + 1]; ++k) {
+                size_t i = outer, j = indices[k];
+                if (order == SparseLayout::CSC)
+                    swap(i, j);
+                T factor = values[k];
+                T* resultRow = result + i * width;
+                const T* denseRow = dense + j * width;
+                for (size_t c = 0; c != width; ++c)
+                    resultRow[c] += factor * denseRow[c];
+            }
+        }
+    }
+
+    vector<T> operator * (const vector<T>& x) const {
+        assert(x.size() == countColumns);
+        vector<T> y(countRows);
+        multiplyAddVector(x.data(), y.data(), 0, countOuter());
+        return y;
+    }
+
+    Matrix<T> operator * (const Matrix<T>& dense) const {
+        assert(dense.size().first == countColumns);
+        size_t width = dense.size().second;
+        Matrix<T> result(countRows, width);
+        multiplyAddDense(dense.data(), result.data(), width, 0, countOuter());
+        return result;
+    }
+};
+
+// Parallel sparse products split the rows of a CSR matrix between threads;
+// a CSC matrix scatters into arbitrary rows and is multiplied serially.
+
+const size_t PARALLEL_SPARSE_GRAIN = 256;
+
+template <typename T>
+vector<T> multiply(const SparseMatrix<T>& a, const vector<T>& x, ParallelExecution) {
+    if (a.layout() == SparseLayout::CSC)
+        return a * x;
+    assert(x.size() == a.size().second);
+    vector<T> y(a.size().first);
+    parallelRanges(a.size().first, PARALLEL_SPARSE_GRAIN, [&](size_t first, size_t last) {
+        a.multiplyAddVector(x.data(), y.data(), first, last);
+    });
+    return y;
+}
+
+template <typename T>
+Matrix<T> multiply(const SparseMatrix<T>& a, const Matrix<T>& b, ParallelExecution) {
+    if (a.layout() == SparseLayout::CSC)
+        return a * b;
+    assert(b.size().first == a.size().second);
+    size_t width = b.size().second;
+    Matrix<T> result(a.size().first, width);
+    parallelRanges(a.size().first, PARALLEL_SPARSE_GRAIN, [&](size_t first, size_t last) {
+        a.multiplyAddDense(b.data(), result.data(), width, first, last);
+    });
+    return result;
+}
+
+template <typename T>
+ostream& operator <<(ostream& out, const SparseMatrix<T>& matrix) {
+    return out << matrix.toDense();
+}
+
+// Dense factorizations and solvers. Floating-point matrices use partial
+// pivoting; other element types (Rational, ...) only need a nonzero pivot
+// and are solved exactly by fraction-free elimination.
+
+// Column panel width of the blocked factorizations; the trailing update of
+// each panel goes through the GEMM kernel.
+const size_t FACTORIZATION_BLOCK = 64;
+
+template <typename T>
+bool betterPivot(const T& candidate, const T& current) {
+    if constexpr (is_floating_point<T>::value)
+        return std::abs(candidate) > std::abs(current);
+    else
+        return current == T(0) && candidate != T(0);
+}
+
+// Rows of the input reordered by permutation equal L * U, where L is unit
+// lower triangular and stored below the diagonal of factors and U is stored
+// on and above it. Requires an element type with exact division.
+template <typename T>
+struct LUDecomposition {
+    Matrix<T> factors;
+    vector<size_t> permutation;
+    bool swapsOdd = false;
+    bool singular = false;
+};
+
+template <typename T>
+LUDecomposition<T> luDecompose(const Matrix<T>& matrix) {
+    assert(matrix.size().first == matrix.size().second);
+    size_t n = matrix.size().first;
+    LUDecomposition<T> result{matrix, vector<size_t>(n)};
+    iota(result.permutation.begin(), result.permutation.end(), size_t(0));
+    T* a = result.factors.data();
+    T zero(0);
+    vector<T> negatedPanel;
+    for (size_t k0 = 0; k0 < n; k0 += FACTORIZATION_BLOCK) {
+        size_t kEnd = min(n, k0 + FACTORIZATION_BLOCK);
+        // Factor columns [k0, kEnd), swapping whole rows.
+        for (size_t k = k0; k != kEnd; ++k) {
+            size_t pivot = k;
+            for (size_t i = k + 1; i != n; ++i) {
+                if (betterPivot(a[i * n + k], a[pivot * n + k]))
+                    pivot = i;
+            }
+            if (a[pivot * n + k] == zero) {
+                result.singular = true;
+                continue;
+            }
+            if (pivot != k) {
+                swap_ranges(a + k * n, a + (k + 1) * n, a + pivot * n);
+                swap(result.permutation[k], result.permutation[pivot]);
+                result.swapsOdd = !result.swapsOdd;
+            }
+            T diagonal = a[k * n + k];
+            for (size_t i = k + 1; i != n; ++i) {
+                T* row = a + i * n;
+                if (row[k] == zero)
+                    continue;
+                row[k] /= diagonal;
+                T factor = row[k];
+                for (size_t j = k + 1; j != kEnd; ++j)
+                    row[j] -= factor * a[k * n + j];
+            }
+        }
+        if (kEnd == n)
+            break;
+        // U12 = L11^-1 * A12.
+        for (size_t k = k0; k != kEnd; ++k) {
+            for (size_t i = k + 1; i != kEnd; ++i) {
+                T factor = a[i * n + k];
+                for (size_t j = kEnd; j != n; ++j)
+                    a[i * n + j] -= factor * a[k * n + j];
+            }
+        }
+        // A22 -= L21 * U12.
+        size_t rest = n - kEnd, width = kEnd - k0;
+        negatedPanel.resize(rest * width);
+        for (size_t i = 0; i != rest; ++i) {
+            for (size_t j = 0; j != width; ++j)
+                negatedPanel[i * width + j] = -a[(kEnd + i) * n + k0 + j];
+        }
+        multiplyAdd(negatedPanel.data(), width, a + k0 * n + kEnd, n,
+                    a + kEnd * n + kEnd, n, rest, width, rest);
+    }
+    return result;
+}
+
+template <typename T>
+Matrix<T> luSolve(const LUDecomposition<T>& lu, const Matrix<T>& rhs) {
+    if (lu.singular)
+        throw std::domain_error("singular matrix");
+    size_t n = lu.factors.size().first, width = rhs.size().second;
+    assert(rhs.size().first == n);
+    Matrix<T> x(n, width);
+    for (size_t i = 0; i != n; ++i)
+        copy(rhs[lu.permutation[i]].begin(), rhs[lu.permutation[i]].end(), x[i].begin());
+    const T* a = lu.factors.data();
+    T* rows = x.data();
+    for (size_t i = 0; i != n; ++i) {
+        for (size_t p = 0; p != i; ++p) {
+            T factor = a[i * n + p];
+            for (size_t j = 0; j != width; ++j)
+                rows[i * width + j] -= factor * rows[p * width + j];
+        }
+    }
+    for (size_t i = n; i-- != 0; ) {
+        for (size_t p = i + 1; p != n; ++p) {
+            T factor = a[i * n + p];
+            for (size_t j = 0; j != width; ++j)
+                rows[i * width + j] -= factor * rows[p * width + j];
+        }
+        T diagonal = a[i * n + i];
+        for (size_t j = 0; j != width; ++j)
+            rows[i * width + j] /= diagonal;
+    }
+    return x;
+}
+
+// Returns the lower triangular L with L * L^T equal to the symmetric
+// positive definite input; only its lower triangle is read.
+template <typename T>
+Matrix<T> cholesky(const Matrix<T>& matrix) {
+    static_assert(is_floating_point<T>::value, "cholesky needs a floating-point matrix");
+    assert(matrix.size().first == matrix.size().second);
+    size_t n = matrix.size().first;
+    Matrix<T> result = matrix;
+    T* a = result.data();
+    vector<T> negatedPanel, panelTransposed;
+    for (size_t k0 = 0; k0 < n; k0 += FACTORIZATION_BLOCK) {
+        size_t kEnd = min(n, k0 + FACTORIZATION_BLOCK);
+        for (size_t k = k0; k != kEnd; ++k) {
+            if (!(a[k * n + k] > T(0)))
+                throw std::domain_error("matrix is not positive definite");
+            T diagonal = std::sqrt(a[k * n + k]);
+            a[k * n + k] = diagonal;
+            for (size_t i = k + 1; i != n; ++i) {
+                a[i * n + k] /= diagonal;
+                T factor = a[i * n + k];
+                for (size_t j = k + 1; j < kEnd && j <= i; ++j)
+                    a[i * n + j] -= factor * a[j * n + k];
+            }
+        }
+        if (kEnd == n)
+            break;
+        // Lower triangle of A22 -= L21 * L21^T, one GEMM_MC-row stripe at a
+        // time so that only the columns left of the diagonal are updated.
+        size_t rest = n - kEnd, width = kEnd - k0;
+        negatedPanel.resize(rest * width);
+        panelTransposed.resize(width * rest);
+        for (size_t i = 0; i != rest; ++i) {
+            for (size_t j = 0; j != width; ++j) {
+                T element = a[(kEnd + i) * n + k0 + j];
+                negatedPanel[i * width + j] = -element;
+                panelTransposed[j * rest + i] = element;
+            }
+        }
+        for (size_t first = 0; first < rest; first += GEMM_MC) {
+            size_t last = min(rest, first + GEMM_MC);
+            multiplyAdd(negatedPanel.data() + first * width, width, panelTransposed.data(), rest,
+                        a + (kEnd + first) * n + kEnd, n, last - first, width, last);
+        }
+    }
+    for (size_t i = 0; i != n; ++i)
+        fill(a + i * n + i + 1, a + (i + 1) * n, T(0));
+    return result;
+}
+
+// Thin QR factorization of a rows x columns matrix with rows >= columns:
+// q has orthonormal columns and r is columns x columns upper triangular.
+template <typename T>
+struct QRDecomposition {
+    Matrix<T> q, r;
+};
+
+// Applies I - tau * v * v^T to rows [first, first + v.size()) and columns
+// [columnFirst, width) of the row-major matrix a.
+template <typename T>
+void applyHouseholder(T* a, size_t width, const vector<T>& v, T tau,
+                      size_t first, size_t columnFirst) {
+    if (tau == T(0))
+        return;
+    vector<T> w(width - columnFirst, T(0));
+    for (size_t i = 0; i != v.size(); ++i) {
+        const T* row = a + (first + i) * width + columnFirst;
+        T factor = v[i];
+        for (size_t j = 0; j != w.size(); ++j)
+            w[j] += factor * row[j];
+    }
+    for (size_t i = 0; i != v.size(); ++i) {
+        T* row = a + (first + i) * width + columnFirst;
+        T factor = tau * v[i];
+        for (size_t j = 0; j != w.size(); ++j)
+            row[j] -= factor * w[j];
+    }
+}
+
+template <typename T>
+QRDecomposition<T> qrDecompose(const Matrix<T>& matrix) {
+    static_assert(is_floating_point<T>::value, "qrDecompose needs a floating-point matrix");
+    size_t m = matrix.size().first, n = matrix.size().second;
+    assert(m >= n);
+    Matrix<T> work = matrix;
+    T* a = work.data();
+    vector<vector<T>> reflectors(n);
+    vector<T> taus(n);
+    for (size_t k = 0; k != n; ++k) {
+        vector<T>& v = reflectors[k];
+        v.resize(m - k);
+        T norm(0);
+        for (size_t i = k; i != m; ++i) {
+            v[i - k] = a[i * n + k];
+            norm += v[i - k] * v[i - k];
+        }
+        norm = std::sqrt(norm);
+        T alpha = v[0] > T(0) ? -norm : norm;
+        v[0] -= alpha;
+        T lengthSquared(0);
+        for (const T& element : v)
+            lengthSquared += element * element;
+        taus[k] = lengthSquared == T(0) ? T(0) : T(2) / lengthSquared;
+        applyHouseholder(a, n, v, taus[k], k, k);
+    }
+    QRDecomposition<T> result{Matrix<T>(m, n), Matrix<T>(n, n)};
+    for (size_t i = 0; i != n; ++i) {
+        result.q[i][i] = T(1);
+        copy(a + i * n + i, a + (i + 1) * n, result.r[i].begin() + i);
+    }
+    for (size_t k = n; k-- != 0; )
+        applyHouseholder(result.q.data(), n, reflectors[k], taus[k], k, k);
+    return result;
+}
+
+// Fraction-free (Bareiss) elimination of the first pivotColumns columns.
+// Every intermediate entry is a minor of the input, so the divisions are
+// exact and entries do not grow as fractions would. Returns false if some
+// column has no nonzero pivot.
+template <typename T>
+bool fractionFreeEliminate(Matrix<T>& matrix, size_t pivotColumns, bool& swapsOdd) {
+    size_t rows = matrix.size().first, width = matrix.size().second;
+    T* a = matrix.data();
+    T zero(0), previous(1);
+    for (size_t k = 0; k != pivotColumns; ++k) {
+        if (a[k * width + k] == zero) {
+            size_t pivot = k + 1;
+            while (pivot < rows && a[pivot * width + k] == zero)
+                ++pivot;
+            if (pivot >= rows)
+                return false;
+            swap_ranges(a + k * width, a + (k + 1) * width, a + pivot * width);
+            swapsOdd = !swapsOdd;
+        }
+        T diagonal = a[k * width + k];
+        for (size_t i = k + 1; i != rows; ++i) {
+            T* row = a + i * width;
+            T factor = row[k];
+            for (size_t j = k + 1; j != width; ++j)
+                row[j] = (row[j] * diagonal - factor * a[k * width + j]) / previous;
+            row[k] = zero;
+        }
+        previous = diagonal;
+    }
+    return true;
+}
+
+template <typename T>
+Matrix<T> fractionFreeSolve(const Matrix<T>& matrix, const Matrix<T>& rhs) {
+    size_t n = matrix.size().first, width = rhs.size().second;
+    assert(matrix.size().second == n && rhs.size().first == n);
+    Matrix<T> augmented(n, n + width);
+    for (size_t i = 0; i != n; ++i) {
+        copy(matrix[i].begin(), matrix[i].end(), augmented[i].begin());
+        copy(rhs[i].begin(), rhs[i].end(), augmented[i].begin() + n);
+    }
+    bool swapsOdd = false;
+    if (!fractionFreeEliminate(augmented, n, swapsOdd))
+        throw std::domain_error("singular matrix");
+    Matrix<T> x(n, width);
+    for (size_t i = n; i-- != 0; ) {
+        for (size_t j = 0; j != width; ++j) {
+            T sum = augmented[i][n + j];
+            for (size_t p = i + 1; p != n; ++p)
+                sum -= augmented[i][p] * x[p][j];
+            x[i][j] = sum / augmented[i][i];
+        }
+    }
+    return x;
+}
+
+// Integer matrices are rejected: the last division of each unknown would
+// truncate. determinant stays exact for them.
+template <typename T>
+Matrix<T> solve(const Matrix<T>& matrix, const Matrix<T>& rhs) {
+    static_assert(!is_integral<T>::value, "solve needs a matrix over a field, not integers");
+    if constexpr (is_floating_point<T>::value)
+        return luSolve(luDecompose(matrix), rhs);
+    else
+        return fractionFreeSolve(matrix, rhs);
+}
+
+template <typename T>
+vector<T> solve(const Matrix<T>& matrix, const vector<T>& rhs) {
+    Matrix<T> column(rhs.size(), 1);
+    copy(rhs.begin(), rhs.end(), column.data());
+    Matrix<T> x = solve(matrix, column);
+    return vector<T>(x.data(), x.data() + rhs.size());
+}
+
+template <typename T>
+Matrix<T> inverse(const Matrix<T>& matrix) {
+    static_assert(!is_integral<T>::value, "inverse needs a matrix over a field, not integers");
+    size_t n = matrix.size().first;
+    Matrix<T> identity(n, n);
+    for (size_t i = 0; i != n; ++i)
+        identity[i][i] = T(1);
+    return solve(matrix, identity);
+}
+
+template <typename T>
+T determinant(const Matrix<T>& matrix) {
+    assert(matrix.size().first == matrix.size().second);
+    size_t n = matrix.size().first;
+    if (n == 0)
+        return T(1);
+    if constexpr (is_floating_point<T>::value) {
+        LUDecomposition<T> lu = luDecompose(matrix);
+        if (lu.singular)
+            return T(0);
+        T result(1);
+        for (size_t i = 0; i != n; ++i)
+            result *= lu.factors[i][i];
+        return lu.swapsOdd ? -result : result;
+    } else {
+        Matrix<T> work = matrix;
+        bool swapsOdd = false;
+        if (!fractionFreeEliminate(work, n, swapsOdd))
+            return T(0);
+        T result = work[n - 1][n - 1];
+        return swapsOdd ? -result : result;
+    }
+}
+
+// Powers and exponentials. Each step multiplies into a preallocated buffer
+// and swaps it in, so a whole chain allocates only a fixed set of matrices.
+
+template <typename T>
+Matrix<T> identityMatrix(size_t n) {
+    Matrix<T> result(n, n);
+    for (size_t i = 0; i != n; ++i)
+        result[i][i] = T(1);
+    return result;
+}
+
+// matrix^exponent by repeated squaring.
+template <typename T>
+Matrix<T> pow(const Matrix<T>& matrix, uint64_t exponent) {
+    assert(matrix.size().first == matrix.size().second);
+    size_t n = matrix.size().first;
+    Matrix<T> result = identityMatrix<T>(n), base = matrix, scratch(n, n);
+    bool resultIsIdentity = true;
+    while (exponent != 0) {
+        if (exponent & 1) {
+            if (resultIsIdentity) {
+                result = base;
+                resultIsIdentity = false;
+            } else {
+                multiplyInto(result, base, scratch);
+                swap(result, scratch);
+            }
+        }
+        exponent >>= 1;
+        if (exponent != 0) {
+            multiplyInto(base, base, scratch);
+            swap(base, scratch);
+        }
+    }
+    return result;
+}
+
+// Matrix exponential by scaling and squaring with a degree 6 Pade
+// approximant: the matrix is scaled by 2^-s until its norm is at most 1/2,
+// where the approximant is accurate to double precision, and the result is
+// squared s times.
+template <typename T>
+Matrix<T> expm(const Matrix<T>& matrix) {
+    static_assert(is_floating_point<T>::value, "expm needs a floating-point matrix");
+    assert(matrix.size().first == matrix.size().second);
+    size_t n = matrix.size().first;
+    T norm(0);
+    for (size_t i = 0; i != n; ++i) {
+        T rowSum(0);
+        for (size_t j = 0; j != n; ++j)
+            rowSum += std::abs(matrix[i][j]);
+        norm = max(norm, rowSum);
+    }
+    int squarings = norm > T(0.5) ? static_cast<int>(std::ceil(std::log2(norm / T(0.5)))) : 0;
+    Matrix<T> scaled = matrix * std::ldexp(T(1), -squarings);
+
+    const int degree = 6;
+    Matrix<T> numerator = identityMatrix<T>(n), denominator = numerator;
+    Matrix<T> power = scaled, scratch(n, n);
+    T coefficient(1);
+    for (int k = 1; k <= degree; ++k) {
+        coefficient *= T(degree - k + 1) / T(k * (2 * degree - k + 1));
+        numerator += power * coefficient;
+        if (k % 2 == 0)
+            denominator += power * coefficient;
+        else
+            denominator -= power * coefficient;
+        if (k != degree) {
+            multiplyInto(power, scaled, scratch);
+            swap(power, scratch);
+        }
+    }
+    Matrix<T> result = luSolve(luDecompose(denominator), numerator);
+    for (int i = 0; i < squarings; ++i) {
+        multiplyInto(result, result, scratch);
+        swap(result, scratch);
+    }
+    return result;
+}
+
+// The algorithms above take Matrix<T>, which an expression cannot be
+// deduced as. These overloads evaluate expression arguments once and pass
+// them on; plain matrices still bind to the overloads above.
+
+template <typename L, typename R>
+auto multiply(const MatrixExpression<L>& a, const MatrixExpression<R>& b, ParallelExecution) {
+    return multiply(a.eval(), b.eval(), par);
+}
+
+template <typename E>
+auto transposed(const MatrixExpression<E>& matrix, ParallelExecution) {
+    return transposed(matrix.eval(), par);
+}
+
+template <typename E>
+auto luDecompose(const MatrixExpression<E>& matrix) {
+    return luDecompose(matrix.eval());
+}
+
+template <typename E>
+auto cholesky(const MatrixExpression<E>& matrix) {
+    return cholesky(matrix.eval());
+}
+
+template <typename E>
+auto qrDecompose(const MatrixExpression<E>& matrix) {
+    return qrDecompose(matrix.eval());
+}
+
+template <typename E, typename R>
+auto solve(const MatrixExpression<E>& matrix, const MatrixExpression<R>& rhs) {
+    return solve(matrix.eval(), rhs.eval());
+}
+
+template <typename E, typename T>
+vector<T> solve(const MatrixExpression<E>& matrix, const vector<T>& rhs) {
+    return solve(matrix.eval(), rhs);
+}
+
+template <typename E>
+auto inverse(const MatrixExpression<E>& matrix) {
+    return inverse(matrix.eval());
+}
+
+template <typename E>
+auto determinant(const MatrixExpression<E>& matrix) {
+    return determinant(matrix.eval());
+}
+
+template <typename E>
+auto pow(const MatrixExpression<E>& matrix, uint64_t exponent) {
+    return pow(matrix.eval(), exponent);
+}
+
+template <typename E>
+auto expm(const MatrixExpression<E>& matrix) {
+    return expm(matrix.eval());
+}
@@ -1,56 +1,1057 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+#include "ArrayKernels.h"
+#include "ThreadPool.h"
+
 using namespace std;
 
+// Coefficient multiplication kernels. Coefficient vectors are stored from
+// the constant term up; a product of n and m coefficients has n + m - 1.
+
+// Below this length Karatsuba's extra additions cost more than they save.
+const size_t KARATSUBA_THRESHOLD = 32;
+// Shorter operand length from which the FFT and NTT paths are used.
+const size_t FFT_THRESHOLD = 64;
+const size_t NTT_THRESHOLD = 128;
+// Longest NTT transform: 998244353 - 1 = 119 * 2^23 has no roots of unity
+// of higher power-of-two order. The NTT path takes products of at most this
+// many coefficients with signed coefficients of at most 32 bits; pairwise
+// products then fit in 62 bits and fewer than 2^23 of them add up to every
+// coefficient, which keeps it below 2^85 in absolute value. Longer products
+// and wider or unsigned types, whose products wrap, use Karatsuba.
+const size_t NTT_MAX_LENGTH = size_t(1) << 23;
+
+// Adds a * b to out.
+template <typename T>
+void multiplySchoolbook(const T* a, size_t n, const T* b, size_t m, T* out) {
+    for (size_t i = 0; i != n; ++i) {
+        T factor = a[i];
+        for (size_t j = 0; j != m; ++j)
+            out[i + j] += factor * b[j];
+    }
+}
+
+// Adds a * b to out, both operands having n coefficients.
+template <typename T>
+void multiplyKaratsuba(const T* a, const T* b, size_t n, T* out) {
+    if (n < KARATSUBA_THRESHOLD) {
+        multiplySchoolbook(a, n, b, n, out);
+        return;
+    }
+    // a = a0 + x^h * a1 and b = b0 + x^h * b1, where a1 and b1 are at least
+    // as long as a0 and b0.
+    size_t h = n / 2, high = n - h;
+    vector<T> low(2 * h - 1), top(2 * high - 1), middle(2 * high - 1);
+    multiplyKaratsuba(a, b, h, low.data());
+    multiplyKaratsuba(a + h, b + h, high, top.data());
+    vector<T> sumA(a + h, a + n), sumB(b + h, b + n);
+    for (size_t i = 0; i != h; ++i) {
+        sumA[i] += a[i];
+        sumB[i] += b[i];
+    }
+    multiplyKaratsuba(sumA.data(), sumB.data(), high, middle.data());
+    for (size_t i = 0; i != low.size(); ++i) {
+        out[i] += low[i];
+        middle[i] -= low[i];
+    }
+    for (size_t i = 0; i != top.size(); ++i) {
+        out[2 * h + i] += top[i];
+        middle[i] -= top[i];
+    }
+    for (size_t i = 0; i != middle.size(); ++i)
+        out[h + i] += middle[i];
+}
+
+// Adds a * b to out for operands of any lengths by cutting the longer one
+// into pieces as long as the shorter one.
+template <typename T>
+void multiplyKaratsuba(const T* a, size_t n, const T* b, size_t m, T* out) {
+    if (n < m) {
+        swap(a, b);
+        swap(n, m);
+    }
+    vector<T> piece(m, T(0));
+    for (size_t first = 0; first < n; first += m) {
+        size_t length = min(m, n - first);
+        if (length == m) {
+            multiplyKaratsuba(a + first, b, m, out + first);
+        } else {
+            copy(a + first, a + n, piece.begin());
+            fill(piece.begin() + length, piece.end(), T(0));
+            vector<T> tail(2 * m - 1, T(0));
+            multiplyKaratsuba(piece.data(), b, m, tail.data());
+            for (size_t i = 0; i != length + m - 1; ++i)
+                out[first + i] += tail[i];
+        }
+    }
+}
+
+template <typename T>
+struct IsStdComplex : false_type {};
+
+template <typename F>
+struct IsStdComplex<complex<F>> : is_floating_point<F> {};
+
+// Coefficient types whose arithmetic is exact and whose division inverts
+// multiplication. Algorithms that rely on leading terms cancelling exactly
+// are restricted to these. A class type may wrap doubles, so none is
+// assumed exact: specialize to opt a type in, as for Rational below.
+template <typename T>
+struct IsExactField : false_type {};
+
+class Rational;
+
+template <>
+struct IsExactField<Rational> : true_type {};
+
+// In-place iterative radix-2 FFT; the length of a must be a power of two.
+template <typename F>
+void fft(vector<complex<F>>& a, bool inverse) {
+    size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            swap(a[i], a[j]);
+    }
+    // Roots are computed directly rather than by repeated multiplication,
+    // which would accumulate rounding errors.
+    const F pi = acos(F(-1));
+    vector<complex<F>> roots(n / 2);
+    for (size_t k = 0; k != roots.size(); ++k)
+        roots[k] = polar(F(1), (inverse ? -2 : 2) * pi * F(k) / F(n));
+    for (size_t length = 2; length <= n; length <<= 1) {
+        size_t half = length / 2, step = n / length;
+        for (size_t first = 0; first < n; first += length) {
+            for (size_t k = 0; k != half; ++k) {
+                complex<F> u = a[first + k], v = a[first + k + half] * roots[k * step];
+                a[first + k] = u + v;
+                a[first + k + half] = u - v;
+            }
+        }
+    }
+    if (inverse) {
+        for (complex<F>& x : a)
+            x /= F(n);
+    }
+}
+
+// Product of floating-point or std::complex coefficient vectors through
+// the FFT.
+template <typename T>
+vector<T> multiplyFft(const T* a, size_t n, const T* b, size_t m) {
+    typedef typename conditional<IsStdComplex<T>::value, T,
+                                 complex<typename common_type<T, double>::type>>::type Point;
+    size_t resultSize = n + m - 1, size = 1;
+    while (size < resultSize)
+        size <<= 1;
+    vector<Point> fa(a, a + n), fb(b, b + m);
+    fa.resize(size);
+    fb.resize(size);
+    fft(fa, false);
+    fft(fb, false);
+    for (size_t i = 0; i != size; ++i)
+        fa[i] *= fb[i];
+    fft(fa, true);
+    vector<T> result(resultSize);
+    for (size_t i = 0; i != resultSize; ++i) {
+        if constexpr (IsStdComplex<T>::value)
+            result[i] = fa[i];
+        else
+            result[i] = static_cast<T>(fa[i].real());
+    }
+    return result;
+}
+
+#if defined(__SIZEOF_INT128__)
+// Number-theoretic transform modulo a prime of the form c * 2^k + 1 with
+// primitive root 3.
+template <uint32_t Mod>
+struct NttPrime {
+    static uint32_t power(uint64_t base, uint64_t exponent) {
+        uint64_t result = 1;
+        for (base %= Mod; exponent != 0; exponent >>= 1, base = base * base % Mod) {
+            if (exponent & 1)
+                result = result * base % Mod;
+        }
+        return static_cast<uint32_t>(result);
+    }
+
+    static void transform(vector<uint32_t>& a, bool inverse) {
+        size_t n = a.size();
+        for (size_t i = 1, j = 0; i < n; ++i) {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                swap(a[i], a[j]);
+        }
+        vector<uint32_t> roots(n / 2 + 1);
+        for (size_t length = 2; length <= n; length <<= 1) {
+            uint32_t root = power(3, (Mod - 1) / length);
+            if (inverse)
+                root = power(root, Mod - 2);
+            size_t half = length / 2;
+            roots[0] = 1;
+            for (size_t k = 1; k != half; ++k)
+                roots[k] = static_cast<uint64_t>(roots[k - 1]) * root % Mod;
+            for (size_t first = 0; first < n; first += length) {
+                for (size_t k = 0; k != half; ++k) {
+                    uint32_t u = a[first + k];
+                    uint32_t v = static_cast<uint64_t>(a[first + k + half]) * roots[k] % Mod;
+                    a[first + k] = u + v >= Mod ? u + v - Mod : u + v;
+                    a[first + k + half] = u >= v ? u - v : u + Mod - v;
+                }
+            }
+        }
+        if (inverse) {
+            uint64_t scale = power(n, Mod - 2);
+            for (uint32_t& x : a)
+                x = static_cast<uint32_t>(x * scale % Mod);
+        }
+    }
+
+    template <typename T>
+    static vector<uint32_t> multiply(const T* a, size_t n, const T* b, size_t m, size_t size) {
+        auto reduce = [](T x) {
+            long long r = static_cast<long long>(x % static_cast<long long>(Mod));
+            return static_cast<uint32_t>(r < 0 ? r + Mod : r);
+        };
+        vector<uint32_t> fa(size), fb(size);
+        for (size_t i = 0; i != n; ++i)
+            fa[i] = reduce(a[i]);
+        for (size_t i = 0; i != m; ++i)
+            fb[i] = reduce(b[i]);
+        transform(fa, false);
+        transform(fb, false);
+        for (size_t i = 0; i != size; ++i)
+            fa[i] = static_cast<uint32_t>(static_cast<uint64_t>(fa[i]) * fb[i] % Mod);
+        transform(fa, true);
+        return fa;
+    }
+};
+
+// Exact product of integer coefficient vectors: three NTTs modulo primes
+// whose product exceeds 2^85 in absolute value on either side, combined by
+// the Chinese remainder theorem. The convolution is reconstructed before it
+// is narrowed to T, so it must stay inside that range (see NTT_MAX_LENGTH).
+template <typename T>
+vector<T> multiplyNtt(const T* a, size_t n, const T* b, size_t m) {
+    const uint32_t p1 = 998244353, p2 = 167772161, p3 = 469762049;
+    size_t resultSize = n + m - 1, size = 1;
+    while (size < resultSize)
+        size <<= 1;
+    vector<uint32_t> r1 = NttPrime<p1>::multiply(a, n, b, m, size);
+    vector<uint32_t> r2 = NttPrime<p2>::multiply(a, n, b, m, size);
+    vector<uint32_t> r3 = NttPrime<p3>::multiply(a, n, b, m, size);
+    const uint64_t inv1Mod2 = NttPrime<p2>::power(p1, p2 - 2);
+    const uint64_t inv12Mod3 = NttPrime<p3>::power(static_cast<uint64_t>(p1) * p2 % p3, p3 - 2);
+    const unsigned __int128 p12 = static_cast<unsigned __int128>(p1) * p2;
+    const unsigned __int128 modulus = p12 * p3;
+    vector<T> result(resultSize);
+    for (size_t i = 0; i != resultSize; ++i) {
+        // Garner's algorithm: x = r1 + p1 * t2 + p1 * p2 * t3.
+        uint64_t t2 = (r2[i] + p2 - r1[i] % p2) % p2 * inv1Mod2 % p2;
+        unsigned __int128 x12 = r1[i] + static_cast<unsigned __int128>(p1) * t2;
+        uint64_t t3 = (r3[i] + p3 - static_cast<uint64_t>(x12 % p3)) % p3 * inv12Mod3 % p3;
+        unsigned __int128 x = x12 + p12 * t3;
+        if (x > modulus / 2)
+            result[i] = static_cast<T>(-static_cast<long long>(static_cast<uint64_t>(modulus - x)));
+        else
+            result[i] = static_cast<T>(static_cast<long long>(static_cast<uint64_t>(x)));
+    }
+    return result;
+}
+#endif
+
+// Product of two nonempty coefficient vectors, picking the fastest method
+// for the coefficient type and sizes.
+template <typename T>
+vector<T> multiplyCoefficients(const T* a, size_t n, const T* b, size_t m) {
+    size_t shorter = min(n, m);
+    if constexpr (is_floating_point<T>::value || IsStdComplex<T>::value) {
+        if (shorter >= FFT_THRESHOLD)
+            return multiplyFft(a, n, b, m);
+    }
+#if defined(__SIZEOF_INT128__)
+    if constexpr (is_integral<T>::value && is_signed<T>::value && sizeof(T) <= 4) {
+        if (shorter >= NTT_THRESHOLD && n + m - 1 <= NTT_MAX_LENGTH)
+            return multiplyNtt(a, n, b, m);
+    }
+#endif
+    vector<T> result(n + m - 1);
+    if (shorter < KARATSUBA_THRESHOLD)
+        multiplySchoolbook(a, n, b, m, result.data());
+    else
+        multiplyKaratsuba(a, n, b, m, result.data());
+    return result;
+}
+
+// Division kernels. The dividend a has n coefficients and the divisor b has
+// m <= n coefficients with a nonzero leading one.
+
+// Quotient length and divisor length from which division goes through
+// Newton iteration instead of long division.
+const size_t NEWTON_DIVISION_THRESHOLD = 128;
+
+// Long division in place: stores the n - m + 1 quotient coefficients in
+// quotient and leaves the remainder in a. Over exact fields and floating
+// point the top n - m + 1 coefficients of the remainder are zero by
+// construction and are dropped; over integers truncated quotients may leave
+// them nonzero.
+template <typename T, typename Buffer>
+void divideLong(Buffer& a, const T* b, size_t m, Buffer& quotient) {
+    size_t n = a.size();
+    quotient.assign(n - m + 1, T(0));
+    T zero(0), lead = b[m - 1];
+    for (size_t k = n - m + 1; k-- != 0; ) {
+        T q = a[k + m - 1] / lead;
+        quotient[k] = q;
+        if (q == zero)
+            continue;
+        for (size_t j = 0; j != m; ++j)
+            a[k + j] -= q * b[j];
+    }
+    if constexpr (!is_integral<T>::value)
+        a.resize(m - 1);
+}
+
+// First k coefficients of the power series 1 / f, where f[0] != 0, by
+// Newton iteration g <- g * (2 - f * g), doubling the precision each step.
+template <typename T>
+vector<T> inverseSeries(const vector<T>& f, size_t k) {
+    vector<T> g{T(1) / f[0]};
+    while (g.size() < k) {
+        size_t length = min(2 * g.size(), k);
+        vector<T> error = multiplyCoefficients(f.data(), min(f.size(), length), g.data(), g.size());
+        error.resize(length);
+        for (T& x : error)
+            x = -x;
+        error[0] += T(2);
+        vector<T> next = multiplyCoefficients(g.data(), g.size(), error.data(), length);
+        next.resize(length);
+        g.swap(next);
+    }
+    return g;
+}
+
+// Division in O(M(n)) for coefficient types with exact division: the
+// reversed quotient is the reversed dividend times the inverse of the
+// reversed divisor modulo x^(n - m + 1). Same contract as divideLong.
+template <typename T>
+void divideNewton(vector<T>& a, const T* b, size_t m, vector<T>& quotient) {
+    size_t n = a.size(), k = n - m + 1;
+    vector<T> reversedA(a.rbegin(), a.rbegin() + k), reversedB(b, b + m);
+    reverse(reversedB.begin(), reversedB.end());
+    vector<T> inverse = inverseSeries(reversedB, k);
+    quotient = multiplyCoefficients(reversedA.data(), k, inverse.data(), k);
+    quotient.resize(k);
+    reverse(quotient.begin(), quotient.end());
+    // Only the low m - 1 coefficients of a - quotient * b are nonzero.
+    a.resize(m - 1);
+    if (m > 1) {
+        vector<T> product = multiplyCoefficients(quotient.data(), min(k, m - 1), b, m - 1);
+        for (size_t i = 0; i != m - 1; ++i)
+            a[i] -= product[i];
+    }
+}
+
+// Picks the division algorithm for the given sizes.
+template <typename T>
+void divideCoefficients(vector<T>& a, const T* b, size_t m, vector<T>& quotient) {
+    bool newton = !is_integral<T>::value &&
+                  min(a.size() - m + 1, m) >= NEWTON_DIVISION_THRESHOLD;
+    if (newton)
+        divideNewton(a, b, m, quotient);
+    else
+        divideLong(a, b, m, quotient);
+}
+
+// Euclid's algorithm and half-GCD. These work on trimmed coefficient
+// vectors: no trailing zeros, and the zero polynomial is empty.
+
+// Divisor length from which Euclid hands over to half-GCD, and the length
+// below which half-GCD itself finishes with plain Euclid steps. Half-GCD
+// only runs over exact fields, which multiply by Karatsuba; it overtakes
+// Euclid's cheap O(n) steps around 2^15 coefficients.
+const size_t HALF_GCD_THRESHOLD = 32768;
+const size_t HALF_GCD_BASE = 128;
+
+template <typename T>
+void trimZeros(vector<T>& a) {
+    T zero(0);
+    while (!a.empty() && a.back() == zero)
+        a.pop_back();
+}
+
+template <typename T>
+vector<T> multiplyTrimmed(const vector<T>& a, const vector<T>& b) {
+    if (a.empty() || b.empty())
+        return {};
+    vector<T> result = multiplyCoefficients(a.data(), a.size(), b.data(), b.size());
+    trimZeros(result);
+    return result;
+}
+
+template <typename T>
+void addTrimmed(vector<T>& a, const vector<T>& b) {
+    if (a.size() < b.size())
+        a.resize(b.size(), T(0));
+    for (size_t i = 0; i != b.size(); ++i)
+        a[i] += b[i];
+    trimZeros(a);
+}
+
+template <typename T>
+void subtractTrimmed(vector<T>& a, const vector<T>& b) {
+    if (a.size() < b.size())
+        a.resize(b.size(), T(0));
+    for (size_t i = 0; i != b.size(); ++i)
+        a[i] -= b[i];
+    trimZeros(a);
+}
+
+// 2x2 polynomial matrix taking a pair of consecutive remainders to a later
+// pair: (a', b') = m * (a, b).
+template <typename T>
+struct EuclidMatrix {
+    vector<T> m[2][2];
+
+    static EuclidMatrix identity() {
+        EuclidMatrix result;
+        result.m[0][0] = result.m[1][1] = {T(1)};
+        return result;
+    }
+
+    EuclidMatrix operator * (const EuclidMatrix& other) const {
+        EuclidMatrix result;
+        for (int i = 0; i != 2; ++i) {
+            for (int j = 0; j != 2; ++j) {
+                result.m[i][j] = multiplyTrimmed(m[i][0], other.m[0][j]);
+                addTrimmed(result.m[i][j], multiplyTrimmed(m[i][1], other.m[1][j]));
+            }
+        }
+        return result;
+    }
+
+    void apply(vector<T>& a, vector<T>& b) const {
+        vector<T> first = multiplyTrimmed(m[0][0], a);
+        addTrimmed(first, multiplyTrimmed(m[0][1], b));
+        vector<T> second = multiplyTrimmed(m[1][0], a);
+        addTrimmed(second, multiplyTrimmed(m[1][1], b));
+        a.swap(first);
+        b.swap(second);
+    }
+
+    // Left-multiplies by [[0, 1], [1, -quotient]], one step of Euclid.
+    void step(const vector<T>& quotient) {
+        swap(m[0][0], m[1][0]);
+        swap(m[0][1], m[1][1]);
+        for (int j = 0; j != 2; ++j)
+            subtractTrimmed(m[1][j], multiplyTrimmed(quotient, m[0][j]));
+    }
+};
+
+// One Euclid step in place: (a, b) becomes (b, a mod b).
+template <typename T>
+void euclidStep(vector<T>& a, vector<T>& b, vector<T>& quotient) {
+    if (a.size() >= b.size()) {
+        divideCoefficients(a, b.data(), b.size(), quotient);
+        trimZeros(a);
+    } else {
+        quotient.clear();
+    }
+    a.swap(b);
+}
+
+// Splits a at shift: a keeps the low coefficients, the rest are returned.
+template <typename T>
+vector<T> splitHigh(vector<T>& a, size_t shift) {
+    vector<T> high(a.begin() + shift, a.end());
+    a.resize(shift);
+    trimZeros(a);
+    return high;
+}
+
+// a += x^shift * high.
+template <typename T>
+void addShifted(vector<T>& a, const vector<T>& high, size_t shift) {
+    if (a.size() < shift + high.size())
+        a.resize(shift + high.size(), T(0));
+    for (size_t i = 0; i != high.size(); ++i)
+        a[shift + i] += high[i];
+    trimZeros(a);
+}
+
+// For deg a > deg b, replaces (a, b) by the first pair of remainders with
+// deg a >= ceil(deg a / 2) > deg b and returns the matrix that took them
+// there. Only the top halves decide the quotients, so each level reduces
+// them recursively and applies the matrix to the low halves alone; the
+// work is O(M(n) log n).
+template <typename T>
+EuclidMatrix<T> halfGcd(vector<T>& a, vector<T>& b) {
+    size_t half = a.size() / 2;
+    EuclidMatrix<T> result = EuclidMatrix<T>::identity();
+    if (b.size() <= half)
+        return result;
+    vector<T> quotient;
+    if (a.size() < HALF_GCD_BASE) {
+        while (b.size() > half) {
+            euclidStep(a, b, quotient);
+            result.step(quotient);
+        }
+        return result;
+    }
+    vector<T> highA = splitHigh(a, half), highB = splitHigh(b, half);
+    result = halfGcd(highA, highB);
+    result.apply(a, b);
+    addShifted(a, highA, half);
+    addShifted(b, highB, half);
+    if (b.size() <= half)
+        return result;
+    euclidStep(a, b, quotient);
+    result.step(quotient);
+    size_t shift = 2 * half - (a.size() - 1);
+    if (b.size() <= shift)
+        return result;
+    highA = splitHigh(a, shift);
+    highB = splitHigh(b, shift);
+    EuclidMatrix<T> second = halfGcd(highA, highB);
+    second.apply(a, b);
+    addShifted(a, highA, shift);
+    addShifted(b, highB, shift);
+    return second * result;
+}
+
+// Reduces (a, b) to (gcd, 0) without recursion on the remainder sequence.
+// If cofactors is given it is left-multiplied by every step, so it ends up
+// taking the original pair to the final one.
+template <typename T>
+void euclid(vector<T>& a, vector<T>& b, EuclidMatrix<T>* cofactors) {
+    vector<T> quotient;
+    while (!b.empty()) {
+        if (IsExactField<T>::value && a.size() > b.size() && b.size() >= HALF_GCD_THRESHOLD) {
+            EuclidMatrix<T> reduction = halfGcd(a, b);
+            if (cofactors)
+                *cofactors = reduction * *cofactors;
+            if (b.empty())
+                break;
+        }
+        euclidStep(a, b, quotient);
+        if (cofactors)
+            cofactors->step(quotient);
+        // Truncated integer quotients may fail to lower the degree, and
+        // further steps would never make progress.
+        if (is_integral<T>::value && b.size() >= a.size())
+            break;
+    }
+}
+
+// Coefficient-wise arithmetic runs the elementwise kernels of ArrayKernels.h
+// over ranges of coefficients, on the shared thread pool of ThreadPool.h for
+// long polynomials.
+
+// Least number of coefficients in a range handled by one pool task.
+const size_t PARALLEL_COEFFICIENTS = size_t(1) << 18;
+
+// Evaluation kernels. A polynomial is evaluated by Horner's rule; many
+// points at once go through packed Horner loops for arithmetic types, or
+// through a subproduct tree over exact fields.
+
+// Degree from which a single point is evaluated with two Horner chains in
+// x^2, the first level of Estrin's scheme, so that independent multiplies
+// overlap in the pipeline.
+const size_t ESTRIN_THRESHOLD = 16;
+// Number of points, and of coefficients, from which multipoint evaluation
+// and interpolation over exact fields go through a subproduct tree.
+const size_t SUBPRODUCT_THRESHOLD = 512;
+// Node size at which the subproduct tree descent finishes by Horner.
+const size_t SUBPRODUCT_LEAF = 32;
+
+template <typename T>
+T hornerValue(const T* coef, size_t n, const T& x) {
+    if (n == 0)
+        return T(0);
+    T result = coef[n - 1];
+    for (size_t k = n - 1; k-- != 0; ) {
+        result *= x;
+        result += coef[k];
+    }
+    return result;
+}
+
+// p(x) = even(x^2) + x * odd(x^2), the two halves evaluated side by side.
+template <typename T>
+T estrinValue(const T* coef, size_t n, const T& x) {
+    T square = x * x, even(0), odd(0);
+    size_t k = n;
+    if (k % 2 == 1)
+        even = coef[--k];
+    for (; k != 0; k -= 2) {
+        odd = odd * square + coef[k - 1];
+        even = even * square + coef[k - 2];
+    }
+    return even + x * odd;
+}
+
+template <typename T>
+T evaluatePoint(const T* coef, size_t n, const T& x) {
+    if constexpr (is_arithmetic<T>::value) {
+        if (n >= ESTRIN_THRESHOLD)
+            return estrinValue(coef, n, x);
+    }
+    return hornerValue(coef, n, x);
+}
+
+// out[i] = p(xs[i]) for the n coefficients of p.
+template <typename T>
+void hornerArrays(const T* coef, size_t n, const T* xs, size_t count, T* out) {
+    for (size_t i = 0; i != count; ++i)
+        out[i] = hornerValue(coef, n, xs[i]);
+}
+
+#if defined(__GNUC__)
+// Runs Horner's rule on two packs of points at a time, so that each
+// multiply-add has an independent one to overlap with.
+template <typename T>
+inline __attribute__((always_inline)) void hornerArraysPacked(const T* coef, size_t n, const T* xs,
+                                                              size_t count, T* out) {
+    typedef T Pack __attribute__((vector_size(64)));
+    const size_t width = sizeof(Pack) / sizeof(T);
+    size_t i = 0;
+    if (n != 0) {
+        for (; i + 2 * width <= count; i += 2 * width) {
+            Pack x0, x1, r0, r1;
+            memcpy(&x0, xs + i, sizeof(Pack));
+            memcpy(&x1, xs + i + width, sizeof(Pack));
+            r0 = r1 = Pack{} + coef[n - 1];
+            for (size_t k = n - 1; k-- != 0; ) {
+                r0 = r0 * x0 + coef[k];
+                r1 = r1 * x1 + coef[k];
+            }
+            memcpy(out + i, &r0, sizeof(Pack));
+            memcpy(out + i + width, &r1, sizeof(Pack));
+        }
+    }
+    for (; i != count; ++i)
+        out[i] = hornerValue(coef, n, xs[i]);
+}
+#else
+template <typename T>
+void hornerArraysPacked(const T* coef, size_t n, const T* xs, size_t count, T* out) {
+    hornerArrays<T>(coef, n, xs, count, out);
+}
+#endif
+
+ARRAY_SIMD_CLONES inline void hornerArrays(const float* coef, size_t n, const float* xs,
+                                            size_t count, float* out) {
+    hornerArraysPacked(coef, n, xs, count, out);
+}
+
+ARRAY_SIMD_CLONES inline void hornerArrays(const double* coef, size_t n, const double* xs,
+                                            size_t count, double* out) {
+    hornerArraysPacked(coef, n, xs, count, out);
+}
+
+ARRAY_SIMD_CLONES inline void hornerArrays(const int32_t* coef, size_t n, const int32_t* xs,
+                                            size_t count, int32_t* out) {
+    hornerArraysPacked(coef, n, xs, count, out);
+}
+
+ARRAY_SIMD_CLONES inline void hornerArrays(const int64_t* coef, size_t n, const int64_t* xs,
+                                            size_t count, int64_t* out) {
+    hornerArraysPacked(coef, n, xs, count, out);
+}
+
+// Products of (x - points[i]) over aligned blocks of points: level k holds
+// one polynomial per block of 2^k points, the last block possibly shorter.
+template <typename T>
+class SubproductTree {
+    const T* points;
+    size_t count;
+    vector<vector<vector<T>>> levels;
+
+    static void reduce(vector<T>& a, const vector<T>& modulus, vector<T>& quotient) {
+        if (a.size() >= modulus.size())
+            divideCoefficients(a, modulus.data(), modulus.size(), quotient);
+    }
+
+    void descend(size_t level, size_t index, vector<T>& remainder, T* out) const {
+        size_t first = index << level, last = min(first + (size_t(1) << level), count);
+        if ((size_t(1) << level) <= SUBPRODUCT_LEAF) {
+            for (size_t i = first; i != last; ++i)
+                out[i] = hornerValue(remainder.data(), remainder.size(), points[i]);
+            return;
+        }
+        const vector<vector<T>>& children = levels[level - 1];
+        if (2 * index + 1 == children.size()) {
+            descend(level - 1, 2 * index, remainder, out);
+            return;
+        }
+        vector<T> right = remainder, quotient;
+        reduce(remainder, children[2 * index], quotient);
+        reduce(right, children[2 * index + 1], quotient);
+        descend(level - 1, 2 * index, remainder, out);
+        descend(level - 1, 2 * index + 1, right, out);
+    }
+
+public:
+    SubproductTree(const T* points, size_t count) : points(points), count(count) {
+        levels.emplace_back(count);
+        for (size_t i = 0; i != count; ++i)
+            levels[0][i] = {-points[i], T(1)};
+        while (levels.back().size() > 1) {
+            const vector<vector<T>>& below = levels.back();
+            vector<vector<T>> above((below.size() + 1) / 2);
+            for (size_t j = 0; j != above.size(); ++j) {
+                if (2 * j + 1 == below.size()) {
+                    above[j] = below[2 * j];
+                } else {
+                    above[j] = multiplyCoefficients(below[2 * j].data(), below[2 * j].size(),
+                                                    below[2 * j + 1].data(),
+                                                    below[2 * j + 1].size());
+                }
+            }
+            levels.push_back(move(above));
+        }
+    }
+
+    // The product of all the (x - points[i]).
+    const vector<T>& root() const {
+        return levels.back()[0];
+    }
+
+    // out[i] = p(points[i]) for the n coefficients of p.
+    void evaluate(const T* coef, size_t n, T* out) const {
+        vector<T> remainder(coef, coef + n), quotient;
+        reduce(remainder, root(), quotient);
+        descend(levels.size() - 1, 0, remainder, out);
+    }
+
+    // The sum of weights[i] times the product of (x - points[j]) over all
+    // j != i, combined up the tree.
+    vector<T> combine(const T* weights) const {
+        vector<vector<T>> sums(count);
+        for (size_t i = 0; i != count; ++i)
+            sums[i] = {weights[i]};
+        for (size_t level = 0; level + 1 != levels.size(); ++level) {
+            const vector<vector<T>>& nodes = levels[level];
+            vector<vector<T>> above((sums.size() + 1) / 2);
+            for (size_t j = 0; j != above.size(); ++j) {
+                if (2 * j + 1 == sums.size()) {
+                    above[j] = move(sums[2 * j]);
+                    continue;
+                }
+                const vector<T>& left = sums[2 * j];
+                const vector<T>& right = sums[2 * j + 1];
+                above[j] = multiplyCoefficients(left.data(), left.size(),
+                                                nodes[2 * j + 1].data(), nodes[2 * j + 1].size());
+                vector<T> other = multiplyCoefficients(right.data(), right.size(),
+                                                       nodes[2 * j].data(), nodes[2 * j].size());
+                if (above[j].size() < other.size())
+                    above[j].resize(other.size(), T(0));
+                for (size_t i = 0; i != other.size(); ++i)
+                    above[j][i] += other[i];
+            }
+            sums.swap(above);
+        }
+        return move(sums[0]);
+    }
+};
+
+// out[i] = p(xs[i]) for the n coefficients of p.
+template <typename T>
+void evaluatePoints(const T* coef, size_t n, const T* xs, size_t count, T* out) {
+    if constexpr (IsExactField<T>::value) {
+        if (count >= SUBPRODUCT_THRESHOLD && n >= SUBPRODUCT_THRESHOLD) {
+            // A tree over more points than coefficients costs more than it
+            // saves, so the points are taken in blocks of about n.
+            for (size_t first = 0; first < count; first += n) {
+                size_t length = min(n, count - first);
+                if (length < SUBPRODUCT_THRESHOLD) {
+                    hornerArrays(coef, n, xs + first, length, out + first);
+                } else {
+                    SubproductTree<T> tree(xs + first, length);
+                    tree.evaluate(coef, n, out + first);
+                }
+            }
+            return;
+        }
+    }
+    hornerArrays(coef, n, xs, count, out);
+}
+
+// Coefficients of the polynomial of degree below count that takes the
+// value ys[i] at xs[i], for distinct xs. Over exact fields with many points
+// the Lagrange weights come from a subproduct tree; otherwise Newton's
+// divided differences are expanded in O(count^2).
+template <typename T>
+vector<T> interpolateCoefficients(const T* xs, const T* ys, size_t count) {
+    if (count == 0)
+        return {};
+    if constexpr (IsExactField<T>::value) {
+        if (count >= SUBPRODUCT_THRESHOLD) {
+            SubproductTree<T> tree(xs, count);
+            const vector<T>& root = tree.root();
+            vector<T> derivative(root.size() - 1), weights(count);
+            T factor(0);
+            for (size_t i = 1; i != root.size(); ++i) {
+                factor += T(1);
+                derivative[i - 1] = factor * root[i];
+            }
+            tree.evaluate(derivative.data(), derivative.size(), weights.data());
+            for (size_t i = 0; i != count; ++i)
+                weights[i] = ys[i] / weights[i];
+            return tree.combine(weights.data());
+        }
+    }
+    vector<T> differences(ys, ys + count);
+    for (size_t j = 1; j != count; ++j) {
+        for (size_t i = count - 1; i >= j; --i)
+            differences[i] = (differences[i] - differences[i - 1]) / (xs[i] - xs[i - j]);
+    }
+    vector<T> result(count, T(0));
+    result[0] = differences[count - 1];
+    for (size_t i = count - 1, size = 1; i-- != 0; ++size) {
+        // result = result * (x - xs[i]) + differences[i]
+        for (size_t k = size; k != 0; --k)
+            result[k] = result[k - 1] - xs[i] * result[k];
+        result[0] = differences[i] - xs[i] * result[0];
+    }
+    return result;
+}
+
+// Composition kernels: p(q) for p with n coefficients and q with m.
+
+// Number of coefficients of p from which composition splits p in halves
+// instead of running Horner's rule.
+const size_t COMPOSITION_THRESHOLD = 16;
+
+// Horner's rule on polynomials, accumulating the constant terms in place.
+template <typename T>
+vector<T> composeHorner(const T* p, size_t n, const vector<T>& q) {
+    vector<T> result = {p[n - 1]};
+    for (size_t k = n - 1; k-- != 0; ) {
+        result = multiplyCoefficients(result.data(), result.size(), q.data(), q.size());
+        result[0] += p[k];
+    }
+    return result;
+}
+
+// p(q) = low(q) + q^h * high(q), where h is the largest power of two below
+// n and powers[i] holds q^(2^i). Every product is balanced, so the fast
+// multiplication kernels apply and the work is O(M(nm) log n).
+template <typename T>
+vector<T> composeSplit(const T* p, size_t n, const vector<vector<T>>& powers) {
+    if (n < COMPOSITION_THRESHOLD)
+        return composeHorner(p, n, powers[0]);
+    size_t level = 0;
+    while ((size_t(2) << level) < n)
+        ++level;
+    size_t h = size_t(1) << level;
+    vector<T> result = composeSplit(p, h, powers);
+    vector<T> high = composeSplit(p + h, n - h, powers);
+    high = multiplyCoefficients(high.data(), high.size(), powers[level].data(),
+                                powers[level].size());
+    if (result.size() < high.size())
+        result.resize(high.size(), T(0));
+    for (size_t i = 0; i != high.size(); ++i)
+        result[i] += high[i];
+    return result;
+}
+
+template <typename T>
+vector<T> composeCoefficients(const T* p, size_t n, const vector<T>& q) {
+    if (n < COMPOSITION_THRESHOLD || q.size() == 1)
+        return composeHorner(p, n, q);
+    vector<vector<T>> powers = {q};
+    while ((size_t(1) << powers.size()) < n) {
+        const vector<T>& last = powers.back();
+        powers.push_back(multiplyCoefficients(last.data(), last.size(), last.data(), last.size()));
+    }
+    return composeSplit(p, n, powers);
+}
+
+// Number of coefficients kept inside a Polynomial object; longer ones go
+// to the heap.
+#ifndef POLYNOMIAL_INLINE_DEGREE
+#define POLYNOMIAL_INLINE_DEGREE 8
+#endif
+
+// Coefficient buffer of a Polynomial: up to POLYNOMIAL_INLINE_DEGREE + 1
+// coefficients live in an array inside the object, longer ones in a heap
+// vector. Shrinking back into the array keeps the vector's capacity, so a
+// polynomial that grows and shrinks again does not reallocate.
+template <typename T>
+class PolynomialStorage {
+public:
+    static const size_t inlineCount = POLYNOMIAL_INLINE_DEGREE + 1;
+
+private:
+    T local[inlineCount] = {};
+    vector<T> heap;
+    size_t count = 0;
+
+public:
+    PolynomialStorage() = default;
+
+    template <typename Iter, typename = typename iterator_traits<Iter>::iterator_category>
+    void assign(Iter first, Iter last) {
+        resize(static_cast<size_t>(distance(first, last)));
+        copy(first, last, begin());
+    }
+
+    void assign(size_t n, const T& value) {
+        resize(n);
+        fill(begin(), end(), value);
+    }
+
+    // Takes over the buffer of a vector too long to be kept inline.
+    void assign(vector<T>&& other) {
+        if (other.size() <= inlineCount) {
+            assign(other.begin(), other.end());
+        } else {
+            heap.swap(other);
+            count = heap.size();
+        }
+    }
+
+    void resize(size_t n, const T& value = T()) {
+        if (n <= inlineCount) {
+            if (count > inlineCount) {
+                copy(heap.begin(), heap.begin() + n, local);
+                heap.clear();
+            } else if (n > count) {
+                fill(local + count, local + n, value);
+            }
+        } else {
+            if (count <= inlineCount)
+                heap.assign(local, local + count);
+            heap.resize(n, value);
+        }
+        count = n;
+    }
+
+    void pop_back() {
+        resize(count - 1);
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    T* data() {
+        return count <= inlineCount ? local : heap.data();
+    }
+
+    const T* data() const {
+        return count <= inlineCount ? local : heap.data();
+    }
+
+    T& operator[](size_t k) {
+        return data()[k];
+    }
+
+    const T& operator[](size_t k) const {
+        return data()[k];
+    }
+
+    const T& back() const {
+        return data()[count - 1];
+    }
+
+    T* begin() {
+        return data();
+    }
+
+    T* end() {
+        return data() + count;
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + count;
+    }
+
+    bool operator == (const PolynomialStorage& other) const {
+        return count == other.count && equal(begin(), end(), other.begin());
+    }
+};
+
+// Coefficients are stored from the constant term up to the leading one,
+// which is nonzero; the zero polynomial has none.
 template <typename T>
 class Polynomial {
-    vector<T> coef;
+    PolynomialStorage<T> coef;
 
     void reduceZeros() {
         T zero = T(0);
-        while (!coef.empty() && coef.back() == zero)
-            coef.pop_back();
-        coef.push_back(zero);
+        size_t size = coef.size();
+        while (size != 0 && coef[size - 1] == zero)
+            --size;
+        coef.resize(size);
     }
 
-    const T& largest() const {
+    T largest() const {
         if (Degree() == -1)
-            return coef.back();
-        return coef[Degree()];
+            return T(0);
+        return coef.back();
     }
 
 public:
     Polynomial(const vector<T> &coef) {
-        this->coef = coef;
+        this->coef.assign(coef.begin(), coef.end());
         reduceZeros();
     }
 
-    Polynomial(T constant = T()) {
-        coef = {constant};
+    Polynomial(vector<T>&& coef) {
+        this->coef.assign(std::move(coef));
         reduceZeros();
     }
 
+    Polynomial(T constant = T()) {
+        if (constant != T(0))
+            coef.assign(1, constant);
+    }
+
     template <typename Iter>
     Polynomial(Iter first, Iter last) {
-        coef = vector<T>(first, last);
+        coef.assign(first, last);
         reduceZeros();
     }
 
-    typename vector<T>::const_iterator begin() const {
+    const T* begin() const {
         return coef.begin();
     }
 
-    typename vector<T>::const_iterator end() const {
-        if (coef.empty())
-            return coef.begin();
-        return std::prev(coef.end());
+    const T* end() const {
+        return coef.end();
     }
 
     T operator[] (size_t power) const {
         if (power < coef.size())
             return coef[power];
-        return coef.back();
+        return T(0);
     }
 
     bool operator == (const Polynomial& other) const {
@@ -62,7 +1063,7 @@ public:
     }
 
     int Degree() const {
-        return static_cast<int>(coef.size()) - 2;
+        return static_cast<int>(coef.size()) - 1;
     }
 
     Polynomial operator +() const {
@@ -74,35 +1075,71 @@ public:
     }
 
     Polynomial& operator += (const Polynomial& other) {
-        coef.resize(max(coef.size(), other.coef.size()));
-        for (size_t i = 0; i != other.coef.size(); ++i) {
-            coef[i] += other.coef[i];
-        }
+        if (coef.size() < other.coef.size())
+            coef.resize(other.coef.size(), T(0));
+        T* dst = coef.data();
+        const T* src = other.coef.data();
+        parallelRanges(other.coef.size(), PARALLEL_COEFFICIENTS,
+                       [dst, src](size_t first, size_t last) {
+            addArrays(dst + first, src + first, last - first);
+        });
         reduceZeros();
         return *this;
     }
 
     Polynomial& operator -= (const Polynomial& other) {
-        coef.resize(max(coef.size(), other.coef.size()));
-        for (size_t i = 0; i != other.coef.size(); ++i) {
-            coef[i] -= other.coef[i];
-        }
+        if (coef.size() < other.coef.size())
+            coef.resize(other.coef.size(), T(0));
+        T* dst = coef.data();
+        const T* src = other.coef.data();
+        parallelRanges(other.coef.size(), PARALLEL_COEFFICIENTS,
+                       [dst, src](size_t first, size_t last) {
+            subtractArrays(dst + first, src + first, last - first);
+        });
+        reduceZeros();
+        return *this;
+    }
+
+    // *this += k * other without building k * other.
+    Polynomial& addScaled(const T& k, const Polynomial& other) {
+        if (coef.size() < other.coef.size())
+            coef.resize(other.coef.size(), T(0));
+        T* dst = coef.data();
+        const T* src = other.coef.data();
+        parallelRanges(other.coef.size(), PARALLEL_COEFFICIENTS,
+                       [dst, &k, src](size_t first, size_t last) {
+            addScaledArray(dst + first, k, src + first, last - first);
+        });
+        reduceZeros();
+        return *this;
+    }
+
+    Polynomial& operator *= (const T& k) {
+        T* dst = coef.data();
+        parallelRanges(coef.size(), PARALLEL_COEFFICIENTS,
+                       [dst, &k](size_t first, size_t last) {
+            scaleArray(dst + first, k, last - first);
+        });
         reduceZeros();
         return *this;
     }
 
     Polynomial& operator *= (const Polynomial& other) {
-        if (Degree() == -1 || other.Degree() == -1)
-            return *this = Polynomial(T(0));
-        auto thisSize = static_cast<size_t>(Degree() + 1);
-        auto otherSize = static_cast<size_t>(other.Degree() + 1);
-        vector<T> resultCoef(thisSize + otherSize);
-        for (size_t i = 0; i != thisSize; ++i) {
-            for (size_t j = 0; j != otherSize; ++j) {
-                resultCoef[i + j] += coef[i] * other.coef[j];
-            }
+        if (Degree() == -1 || other.Degree() == -1) {
+            coef.resize(0);
+            return *this;
+        }
+        size_t thisSize = coef.size(), otherSize = other.coef.size();
+        if (thisSize + otherSize - 1 <= PolynomialStorage<T>::inlineCount) {
+            PolynomialStorage<T> product;
+            product.assign(thisSize + otherSize - 1, T(0));
+            multiplySchoolbook(coef.data(), thisSize, other.coef.data(), otherSize, product.data());
+            coef = product;
+        } else {
+            coef.assign(multiplyCoefficients(coef.data(), thisSize, other.coef.data(), otherSize));
         }
-        return *this = Polynomial(resultCoef);
+        reduceZeros();
+        return *this;
     }
 
     Polynomial operator + (const Polynomial& other) const {
@@ -123,37 +1160,64 @@ public:
         return result;
     }
 
+    Polynomial operator * (const T& k) const {
+        Polynomial result(*this);
+        result *= k;
+        return result;
+    }
+
     T operator () (const T& x) const {
-        T result(0), power(1);
-        for (const T& c : coef) {
-            result += c * power;
-            power *= x;
-        }
+        return evaluatePoint(coef.data(), coef.size(), x);
+    }
+
+    // Values at count points: out[i] = (*this)(xs[i]).
+    void evaluate(const T* xs, size_t count, T* out) const {
+        evaluatePoints(coef.data(), coef.size(), xs, count, out);
+    }
+
+    vector<T> evaluate(const vector<T>& xs) const {
+        vector<T> result(xs.size());
+        evaluate(xs.data(), xs.size(), result.data());
         return result;
     }
 
+    // The polynomial of degree below xs.size() that takes the value ys[i]
+    // at xs[i]. The points must be distinct.
+    static Polynomial interpolate(const vector<T>& xs, const vector<T>& ys) {
+        return Polynomial(interpolateCoefficients(xs.data(), ys.data(), min(xs.size(), ys.size())));
+    }
+
     Polynomial operator & (const Polynomial& other) const {
-        Polynomial result, power{T(1)};
-        for (const T& c : coef) {
-            result += c * power;
-            power *= other;
-        }
-        return result;
+        if (Degree() == -1)
+            return *this;
+        vector<T> inner(other.begin(), other.end());
+        if (inner.empty())
+            inner.push_back(T(0));
+        return Polynomial(composeCoefficients(coef.data(), coef.size(), inner));
     }
 
-    Polynomial operator / (const Polynomial& other) const {
+    // Quotient and remainder of the division by other, computed together.
+    pair<Polynomial, Polynomial> divmod(const Polynomial& other) const {
+        if (other.Degree() == -1)
+            throw std::domain_error("division by zero");
         if (Degree() < other.Degree())
-            return Polynomial(T(0));
-        Polynomial left(*this);
-        vector<T> resCoef(static_cast<size_t>(2 + Degree() - other.Degree()));
-        for (int power = Degree() - other.Degree(); power >= 0; --power) {
-            vector<T> termCoef(static_cast<size_t>(power + 1));
-            T curCoef = left[power + other.Degree()] / other.largest();
-            resCoef[power] = termCoef[power] = curCoef;
-            Polynomial term(termCoef);
-            left -= term * other;
+            return {Polynomial(T(0)), *this};
+        Polynomial quotient, remainder(*this);
+        if (coef.size() <= PolynomialStorage<T>::inlineCount) {
+            divideLong(remainder.coef, other.coef.data(), other.coef.size(), quotient.coef);
+        } else {
+            vector<T> left(coef.begin(), coef.end()), right;
+            divideCoefficients(left, other.coef.data(), other.coef.size(), right);
+            quotient.coef.assign(std::move(right));
+            remainder.coef.assign(std::move(left));
         }
-        return Polynomial(resCoef);
+        quotient.reduceZeros();
+        remainder.reduceZeros();
+        return {quotient, remainder};
+    }
+
+    Polynomial operator / (const Polynomial& other) const {
+        return divmod(other).first;
     }
 
     Polynomial& operator /= (const Polynomial& other) {
@@ -161,19 +1225,34 @@ public:
     }
 
     Polynomial operator % (const Polynomial& other) const {
-        return *this - (*this / other) * other;
+        return divmod(other).second;
     }
 
     Polynomial& operator %= (const Polynomial& other) {
         return *this = *this % other;
     }
 
+    // Greatest common divisor, normalized to a leading coefficient of one.
     Polynomial operator , (const Polynomial& other) const {
-        if (Degree() == -1 && other.Degree() == -1)
-            return *this;
-        else if (other.Degree() == -1)
-            return *this / largest();
-        return (other, *this % other);
+        vector<T> a(begin(), end()), b(other.begin(), other.end());
+        euclid(a, b, static_cast<EuclidMatrix<T>*>(nullptr));
+        Polynomial result(a);
+        if (result.Degree() == -1)
+            return result;
+        return result / result.largest();
+    }
+
+    // Extended GCD: returns (g, s, t) with s * *this + t * other == g, where
+    // g == (*this, other).
+    tuple<Polynomial, Polynomial, Polynomial> xgcd(const Polynomial& other) const {
+        vector<T> a(begin(), end()), b(other.begin(), other.end());
+        EuclidMatrix<T> cofactors = EuclidMatrix<T>::identity();
+        euclid(a, b, &cofactors);
+        if (a.empty())
+            return {Polynomial(), Polynomial(), Polynomial()};
+        Polynomial lead(a.back());
+        return {Polynomial(a) / lead, Polynomial(cofactors.m[0][0]) / lead,
+                Polynomial(cofactors.m[0][1]) / lead};
     }
 };
 
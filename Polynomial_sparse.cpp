@@ -1,22 +1,236 @@
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
-#include <map>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "ArrayKernels.h"
+#include "ThreadPool.h"
+
 using namespace std;
 
-template <typename T>
-class Polynomial {
-    map<int, T> coef;
+// Number of points evaluated together by Polynomial::evaluate.
+const size_t EVALUATION_BLOCK = 256;
+// Number of term products from which a multiplication is split over the
+// thread pool, and the least number each task gets.
+const size_t PARALLEL_PRODUCTS = size_t(1) << 22;
+
+// Term kernels, shared by Polynomial and MultivariatePolynomial. Terms are
+// (exponent, coefficient) pairs sorted by increasing exponent with no zero
+// coefficients. An exponent is an int or a packed monomial; either way
+// exponents compare in the monomial order and add when terms multiply.
+
+// Merges other into terms, writing combine(a, b) for a shared exponent and
+// single(b) for a term only other has. The merge runs from the top down
+// into the end of the resized vector, which never overtakes the terms still
+// to be read, then closes the gap left by cancelled terms. other must not
+// be terms itself.
+template <typename E, typename T, typename Combine, typename Single>
+void mergeTerms(vector<pair<E, T>>& terms, const vector<pair<E, T>>& other,
+                const Combine& combine, const Single& single) {
+    T zero(0);
+    size_t i = terms.size(), j = other.size(), k = i + j;
+    terms.resize(k);
+    while (j != 0) {
+        const pair<E, T>& term = other[j - 1];
+        if (i != 0 && terms[i - 1].first > term.first) {
+            terms[--k] = std::move(terms[--i]);
+        } else if (i != 0 && terms[i - 1].first == term.first) {
+            T value = combine(terms[i - 1].second, term.second);
+            --i;
+            if (value != zero)
+                terms[--k] = {term.first, value};
+            --j;
+        } else {
+            terms[--k] = {term.first, single(term.second)};
+            --j;
+        }
+    }
+    size_t top = terms.size() - k;
+    move(terms.begin() + k, terms.end(), terms.begin() + i);
+    terms.resize(i + top);
+}
 
-    void reduceZeros() {
-        T zero = T();
-        for (auto it = coef.begin(); it != coef.end(); ) {
-            if (it->second == zero) {
-                it = coef.erase(it);
-            } else {
-                ++it;
+// Johnson's heap multiplication. For the terms a[i] of the shorter factor
+// the heap holds the next product a[i] * b[j] not yet emitted, keyed by its
+// exponent, so products come out in increasing order and equal exponents
+// are added up as they meet at the top. Following Monagan and Pearce, the
+// entry for a[i + 1] only enters once a[i] has moved past b[0], which keeps
+// the heap as small as the number of rows in progress.
+template <typename E, typename T>
+vector<pair<E, T>> multiplyTerms(const pair<E, T>* a, size_t n, const pair<E, T>* b, size_t m) {
+    struct Entry {
+        E exponent;
+        size_t i, j;
+    };
+    auto later = [](const Entry& x, const Entry& y) { return x.exponent > y.exponent; };
+    vector<pair<E, T>> result;
+    if (n == 0 || m == 0)
+        return result;
+    vector<Entry> heap, popped;
+    heap.reserve(n);
+    heap.push_back({a[0].first + b[0].first, 0, 0});
+    T zero(0);
+    while (!heap.empty()) {
+        E exponent = heap.front().exponent;
+        T sum(0);
+        popped.clear();
+        while (!heap.empty() && heap.front().exponent == exponent) {
+            pop_heap(heap.begin(), heap.end(), later);
+            const Entry& entry = heap.back();
+            sum += a[entry.i].second * b[entry.j].second;
+            popped.push_back(entry);
+            heap.pop_back();
+        }
+        for (const Entry& entry : popped) {
+            if (entry.j + 1 != m) {
+                heap.push_back({a[entry.i].first + b[entry.j + 1].first, entry.i, entry.j + 1});
+                push_heap(heap.begin(), heap.end(), later);
+            }
+            if (entry.j == 0 && entry.i + 1 != n) {
+                heap.push_back({a[entry.i + 1].first + b[0].first, entry.i + 1, 0});
+                push_heap(heap.begin(), heap.end(), later);
+            }
+        }
+        if (sum != zero)
+            result.emplace_back(exponent, sum);
+    }
+    return result;
+}
+
+// Heap multiplication with the heap over the shorter factor. Large
+// products cut the shorter factor into one chunk per pool thread, multiply
+// the chunks by the other factor on the shared pool of ThreadPool.h and
+// merge the partial products pairwise.
+template <typename E, typename T>
+vector<pair<E, T>> productTerms(const vector<pair<E, T>>& x, const vector<pair<E, T>>& y) {
+    const vector<pair<E, T>>& a = x.size() <= y.size() ? x : y;
+    const vector<pair<E, T>>& b = x.size() <= y.size() ? y : x;
+    size_t products = a.size() * b.size();
+    size_t threads = products < 2 * PARALLEL_PRODUCTS
+                         ? 1 : min({ThreadPool::global().size(), a.size(),
+                                    products / PARALLEL_PRODUCTS});
+    if (threads <= 1)
+        return multiplyTerms(a.data(), a.size(), b.data(), b.size());
+    size_t step = (a.size() + threads - 1) / threads;
+    vector<vector<pair<E, T>>> parts((a.size() + step - 1) / step);
+    ThreadPool::global().forEach(parts.size(), [&](size_t k) {
+        size_t first = k * step, length = min(step, a.size() - first);
+        parts[k] = multiplyTerms(a.data() + first, length, b.data(), b.size());
+    });
+    for (size_t width = 1; width < parts.size(); width *= 2) {
+        for (size_t k = 0; k + width < parts.size(); k += 2 * width) {
+            mergeTerms(parts[k], parts[k + width], [](const T& u, const T& v) { return u + v; },
+                       [](const T& v) { return v; });
+        }
+    }
+    return std::move(parts[0]);
+}
+
+// Johnson's heap division of f by g, producing quotient and remainder in
+// one pass from the top down. The heap holds, for each quotient term q[i]
+// found so far, the next product q[i] * g[j] still to be subtracted, so
+// f - q * g is never formed as a polynomial. A term whose exponent the
+// leading exponent of g divides (divides(exponent, lead)) extends the
+// quotient; the rest of its coefficient goes to the remainder, which over
+// a field only happens when it is not divisible.
+template <typename E, typename T, typename Divides>
+void divideTerms(const vector<pair<E, T>>& f, const vector<pair<E, T>>& g, const Divides& divides,
+                 vector<pair<E, T>>& quotient, vector<pair<E, T>>& remainder) {
+    struct Entry {
+        E exponent;
+        size_t i, j;
+    };
+    auto earlier = [](const Entry& x, const Entry& y) { return x.exponent < y.exponent; };
+    quotient.clear();
+    remainder.clear();
+    if (g.empty())
+        return;
+    // g from the top down; its leading term is top[0].
+    vector<pair<E, T>> top(g.rbegin(), g.rend());
+    vector<Entry> heap;
+    T zero(0);
+    for (size_t next = f.size(); next != 0 || !heap.empty(); ) {
+        E exponent = next != 0 ? f[next - 1].first : heap.front().exponent;
+        if (!heap.empty() && heap.front().exponent > exponent)
+            exponent = heap.front().exponent;
+        T c(0);
+        if (next != 0 && f[next - 1].first == exponent)
+            c = f[--next].second;
+        // Products pushed here have smaller exponents than the ones popped.
+        while (!heap.empty() && heap.front().exponent == exponent) {
+            pop_heap(heap.begin(), heap.end(), earlier);
+            Entry entry = heap.back();
+            heap.pop_back();
+            c -= quotient[entry.i].second * top[entry.j].second;
+            if (entry.j + 1 != top.size()) {
+                heap.push_back({quotient[entry.i].first + top[entry.j + 1].first, entry.i,
+                                entry.j + 1});
+                push_heap(heap.begin(), heap.end(), earlier);
+            }
+        }
+        if (c == zero)
+            continue;
+        if (divides(exponent, top[0].first)) {
+            T q = c / top[0].second;
+            if (q != zero) {
+                quotient.emplace_back(exponent - top[0].first, q);
+                if (top.size() != 1) {
+                    heap.push_back({quotient.back().first + top[1].first, quotient.size() - 1, 1});
+                    push_heap(heap.begin(), heap.end(), earlier);
+                }
+                c -= q * top[0].second;
             }
         }
+        if (c != zero)
+            remainder.emplace_back(exponent, c);
+    }
+    reverse(quotient.begin(), quotient.end());
+    reverse(remainder.begin(), remainder.end());
+}
+
+// x^exponent by repeated squaring, for a nonnegative exponent.
+template <typename T>
+T raisePower(T x, int exponent) {
+    T result(1);
+    for (; exponent != 0; exponent >>= 1) {
+        if (exponent & 1)
+            result *= x;
+        if (exponent > 1)
+            x *= x;
+    }
+    return result;
+}
+
+// Terms are kept in a vector of (exponent, coefficient) pairs sorted by
+// exponent, with no zero coefficients. Sums and differences are linear
+// merges written over the same vector, so they allocate nothing once its
+// capacity suffices; products go through the heap kernel.
+template <typename T>
+class Polynomial {
+    vector<pair<int, T>> coef;
+
+    static bool exponentLess(const pair<int, T>& term, int power) {
+        return term.first < power;
+    }
+
+    template <typename Combine, typename Single>
+    void merge(const Polynomial& other, const Combine& combine, const Single& single) {
+        if (&other == this)
+            mergeTerms(coef, Polynomial(other).coef, combine, single);
+        else
+            mergeTerms(coef, other.coef, combine, single);
+    }
+
+    // Divides by the highest power of x that divides this polynomial.
+    void lowerExponents() {
+        if (coef.empty() || coef.front().first == 0)
+            return;
+        int lowest = coef.front().first;
+        for (pair<int, T>& term : coef)
+            term.first -= lowest;
     }
 
 public:
@@ -24,14 +238,14 @@ public:
         T zero(0);
         for (size_t power = 0; power != coef.size(); ++power) {
             if (coef[power] != zero) {
-                this->coef[power] = coef[power];
+                this->coef.emplace_back(static_cast<int>(power), coef[power]);
             }
         }
     }
 
     Polynomial(T constant = T()) {
         if (constant != T(0)) {
-            coef[0] = constant;
+            coef.emplace_back(0, constant);
         }
     }
 
@@ -40,30 +254,31 @@ public:
         T zero(0);
         for (int dist = 0; first != last; ++first, ++dist) {
             if (*first != zero) {
-                coef[dist] = *first;
+                coef.emplace_back(dist, *first);
             }
         }
     }
 
-    typename map<int, T>::const_iterator begin() const {
+    typename vector<pair<int, T>>::const_iterator begin() const {
         return coef.begin();
     }
 
-    typename map<int, T>::const_iterator end() const {
+    typename vector<pair<int, T>>::const_iterator end() const {
         return coef.end();
     }
 
-    typename map<int, T>::const_reverse_iterator rbegin() const {
+    typename vector<pair<int, T>>::const_reverse_iterator rbegin() const {
         return coef.rbegin();
     }
 
-    typename map<int, T>::const_reverse_iterator rend() const {
+    typename vector<pair<int, T>>::const_reverse_iterator rend() const {
         return coef.rend();
     }
 
     T operator[] (int power) const {
-        if (coef.find(power) != coef.end())
-            return coef.at(power);
+        auto it = lower_bound(coef.begin(), coef.end(), power, exponentLess);
+        if (it != coef.end() && it->first == power)
+            return it->second;
         return T(0);
     }
 
@@ -78,7 +293,7 @@ public:
     int Degree() const {
         if (coef.empty())
             return -1;
-        return coef.rbegin()->first;
+        return coef.back().first;
     }
 
     Polynomial operator +() const {
@@ -90,26 +305,20 @@ public:
     }
 
     Polynomial& operator += (const Polynomial& other) {
-        for (auto it = other.begin(); it != other.end(); ++it) {
-            coef[it->first] += it->second;
-        }
-        reduceZeros();
+        merge(other, [](const T& a, const T& b) { return a + b; },
+              [](const T& b) { return b; });
         return *this;
     }
 
     Polynomial& operator -= (const Polynomial& other) {
-        return *this += -other;
+        merge(other, [](const T& a, const T& b) { return a - b; },
+              [](const T& b) { return -b; });
+        return *this;
     }
 
     Polynomial& operator *= (const Polynomial& other) {
-        Polynomial result;
-        for (auto it = begin(); it != end(); ++it) {
-            for (auto it2 = other.begin(); it2 != other.end(); ++it2) {
-                result.coef[it->first + it2->first] += it->second * it2->second;
-            }
-        }
-        result.reduceZeros();
-        return *this = result;
+        coef = productTerms(coef, other.coef);
+        return *this;
     }
 
     Polynomial operator + (const Polynomial& other) const {
@@ -130,66 +339,224 @@ public:
         return result;
     }
 
+    // Horner's rule over the terms from the top: the running value is
+    // multiplied by x^gap for each exponent gap between neighbouring terms,
+    // the power being found by repeated squaring and reused while the gap
+    // repeats.
     T operator () (const T& x) const {
-        T result(0), term(1);
-        int power = 0;
-        for (auto it = coef.begin(); it != coef.end(); ++it) {
-            while (power < it->first) {
-                term *= x;
-                ++power;
+        T result(0), step(1);
+        int power = Degree(), lastGap = 0;
+        for (auto it = coef.rbegin(); it != coef.rend(); ++it) {
+            int gap = power - it->first;
+            if (gap != 0) {
+                if (gap != lastGap) {
+                    step = raisePower(x, gap);
+                    lastGap = gap;
+                }
+                result *= step;
             }
-            result += it->second * term;
+            result += it->second;
+            power = it->first;
         }
+        if (power > 0)
+            result *= power == lastGap ? step : raisePower(x, power);
         return result;
     }
 
-    Polynomial operator & (const Polynomial& other) const {
-        Polynomial result, term{T(1)};
-        int power = 0;
-        for (auto it = coef.begin(); it != coef.end(); ++it) {
-            while (power < it->first) {
-                term *= other;
-                ++power;
+    // Values at count points: out[i] = (*this)(xs[i]). Points are taken in
+    // blocks that stay in cache. The squares x^(2^k) of a block are
+    // tabulated once, the power for each exponent gap is assembled from
+    // them, and each step of Horner's rule is a multiply-add across the
+    // block.
+    void evaluate(const T* xs, size_t count, T* out) const {
+        if (coef.empty()) {
+            fill(out, out + count, T(0));
+            return;
+        }
+        // The widest gap, counting the one from the lowest term down to x^0.
+        int widest = coef.front().first;
+        for (size_t k = 1; k != coef.size(); ++k)
+            widest = max(widest, coef[k].first - coef[k - 1].first);
+        size_t bits = 0;
+        while ((widest >> bits) != 0)
+            ++bits;
+        vector<T> squares(bits * EVALUATION_BLOCK), step(EVALUATION_BLOCK);
+        for (size_t first = 0; first < count; first += EVALUATION_BLOCK) {
+            size_t length = min(EVALUATION_BLOCK, count - first);
+            const T* x = xs + first;
+            T* result = out + first;
+            for (size_t k = 0; k != bits; ++k) {
+                T* square = squares.data() + k * EVALUATION_BLOCK;
+                if (k == 0) {
+                    copy(x, x + length, square);
+                } else {
+                    copy(square - EVALUATION_BLOCK, square - EVALUATION_BLOCK + length, square);
+                    multiplyArrays(square, square - EVALUATION_BLOCK, length);
+                }
+            }
+            // x^gap for the block: a single square when gap is a power of
+            // two, otherwise a product of squares kept in step.
+            int lastGap = 0;
+            const T* factor = nullptr;
+            auto raise = [&](int gap) {
+                if (gap == lastGap)
+                    return;
+                lastGap = gap;
+                if ((gap & (gap - 1)) == 0) {
+                    size_t k = 0;
+                    while ((gap >> k) != 1)
+                        ++k;
+                    factor = squares.data() + k * EVALUATION_BLOCK;
+                    return;
+                }
+                bool started = false;
+                for (size_t k = 0; k != bits; ++k) {
+                    if (((gap >> k) & 1) == 0)
+                        continue;
+                    const T* square = squares.data() + k * EVALUATION_BLOCK;
+                    if (started)
+                        multiplyArrays(step.data(), square, length);
+                    else
+                        copy(square, square + length, step.data());
+                    started = true;
+                }
+                factor = step.data();
+            };
+            fill(result, result + length, coef.back().second);
+            int power = coef.back().first;
+            for (auto it = coef.rbegin() + 1; it != coef.rend(); ++it) {
+                raise(power - it->first);
+                hornerStepArrays(result, factor, it->second, length);
+                power = it->first;
+            }
+            if (power > 0) {
+                raise(power);
+                multiplyArrays(result, factor, length);
             }
-            result += it->second * term;
         }
+    }
+
+    vector<T> evaluate(const vector<T>& xs) const {
+        vector<T> result(xs.size());
+        evaluate(xs.data(), xs.size(), result.data());
         return result;
     }
 
-    Polynomial operator / (const Polynomial& other) const {
-        if (Degree() < other.Degree())
-            return Polynomial(T(0));
-        Polynomial left(*this), result;
-        for (int power = Degree() - other.Degree(); power >= 0; --power) {
-            if (left.coef.find(power + other.Degree()) != left.coef.end()) {
-                T curCoef = left[power + other.Degree()] / other[other.Degree()];
-                Polynomial term;
-                term.coef[power] = result.coef[power] = curCoef;
-                left -= term * other;
-                left.reduceZeros();
-            }
+    // The polynomial of degree below xs.size() that takes the value ys[i]
+    // at xs[i], from Newton's divided differences. The points must be
+    // distinct.
+    static Polynomial interpolate(const vector<T>& xs, const vector<T>& ys) {
+        size_t count = min(xs.size(), ys.size());
+        if (count == 0)
+            return Polynomial();
+        vector<T> differences(ys.begin(), ys.begin() + count);
+        for (size_t j = 1; j != count; ++j) {
+            for (size_t i = count - 1; i >= j; --i)
+                differences[i] = (differences[i] - differences[i - 1]) / (xs[i] - xs[i - j]);
+        }
+        vector<T> result(count, T(0));
+        result[0] = differences[count - 1];
+        for (size_t i = count - 1, size = 1; i-- != 0; ++size) {
+            for (size_t k = size; k != 0; --k)
+                result[k] = result[k - 1] - xs[i] * result[k];
+            result[0] = differences[i] - xs[i] * result[0];
+        }
+        return Polynomial(result);
+    }
+
+    // Horner's rule over the terms from the top. A gap of several
+    // exponents between neighbouring terms is crossed with a single
+    // multiply by a power of other, found by repeated squaring.
+    Polynomial operator & (const Polynomial& other) const {
+        Polynomial result;
+        int power = Degree();
+        for (auto it = coef.rbegin(); it != coef.rend(); ++it) {
+            if (power > it->first)
+                result *= other.power(power - it->first);
+            power = it->first;
+            result += Polynomial(it->second);
+        }
+        if (power > 0)
+            result *= other.power(power);
+        return result;
+    }
+
+    // This polynomial raised to a nonnegative exponent.
+    Polynomial power(int exponent) const {
+        Polynomial result(T(1)), base(*this);
+        for (; exponent != 0; exponent >>= 1) {
+            if (exponent & 1)
+                result *= base;
+            if (exponent > 1)
+                base *= base;
         }
         return result;
     }
 
+    // Quotient and remainder, found together by the heap kernel without
+    // forming any intermediate polynomial.
+    pair<Polynomial, Polynomial> divmod(const Polynomial& other) const {
+        if (other.coef.empty())
+            throw std::domain_error("division by zero");
+        Polynomial quotient, remainder;
+        divideTerms(coef, other.coef, [](int power, int lead) { return power >= lead; },
+                    quotient.coef, remainder.coef);
+        return {quotient, remainder};
+    }
+
+    Polynomial operator / (const Polynomial& other) const {
+        return divmod(other).first;
+    }
+
     Polynomial& operator /= (const Polynomial& other) {
         return *this = *this / other;
     }
 
     Polynomial operator % (const Polynomial& other) const {
-        return *this - (*this / other) * other;
+        return divmod(other).second;
     }
 
     Polynomial& operator %= (const Polynomial& other) {
         return *this = *this % other;
     }
 
+    // Greatest common divisor, normalized to a leading coefficient of one.
+    // The power of x common to both operands is split off first. What is
+    // left has a nonzero constant term, so x divides none of its factors
+    // and every remainder can drop its own lowest power of x as well, which
+    // shortens the Euclidean sequence for inputs like x^1000 - 1.
     Polynomial operator , (const Polynomial& other) const {
-        if (Degree() == -1 && other.Degree() == -1)
+        if (coef.empty() && other.coef.empty())
             return *this;
-        else if (other.Degree() == -1)
-            return *this / coef.at(Degree());
-        return (other, *this % other);
+        Polynomial a(*this), b(other);
+        int shift = 0;
+        if (a.coef.empty() || b.coef.empty())
+            shift = (a.coef.empty() ? b : a).coef.front().first;
+        else
+            shift = min(a.coef.front().first, b.coef.front().first);
+        a.lowerExponents();
+        b.lowerExponents();
+        while (!b.coef.empty()) {
+            Polynomial remainder = a.divmod(b).second;
+            remainder.lowerExponents();
+            a = std::move(b);
+            b = std::move(remainder);
+            // With integer coefficients the heap division leaves a leading
+            // term whose coefficient the divisor's does not divide in the
+            // remainder, which can then be as long as the divisor.
+            if (is_integral<T>::value && b.Degree() >= a.Degree())
+                break;
+        }
+        T lead = a.coef.back().second, zero(0);
+        size_t size = 0;
+        for (pair<int, T>& term : a.coef) {
+            term.first += shift;
+            term.second /= lead;
+            if (term.second != zero)
+                a.coef[size++] = term;
+        }
+        a.coef.resize(size);
+        return a;
     }
 };
 
@@ -283,3 +650,312 @@ ostream& operator <<(ostream& out, const Polynomial<T>& p) {
     }
     return out;
 }
+
+// Sparse polynomial in a fixed number of variables. A monomial is packed
+// into one 64-bit word: the total degree in the top field, then the
+// exponent of each variable in turn, every field being 64 / (variables + 1)
+// bits wide. Comparing two words compares the monomials in graded
+// lexicographic order and adding them multiplies the monomials, so the term
+// kernels run on them exactly as on the exponents of Polynomial.
+template <typename T>
+class MultivariatePolynomial {
+    size_t variables;
+    unsigned fieldBits;
+    vector<pair<uint64_t, T>> terms;
+
+    // Field 0 is the total degree, field i + 1 the exponent of variable i.
+    uint64_t field(uint64_t monomial, size_t k) const {
+        unsigned shift = static_cast<unsigned>(variables - k) * fieldBits;
+        return (monomial >> shift) & maxExponent();
+    }
+
+    uint64_t maxExponent() const {
+        return (uint64_t(1) << fieldBits) - 1;
+    }
+
+    bool divides(uint64_t monomial, uint64_t divisor) const {
+        for (size_t k = 0; k <= variables; ++k) {
+            if (field(divisor, k) > field(monomial, k))
+                return false;
+        }
+        return true;
+    }
+
+    void checkVariables(const MultivariatePolynomial& other) const {
+        if (variables != other.variables)
+            throw std::invalid_argument("polynomials in different numbers of variables");
+    }
+
+    template <typename Combine, typename Single>
+    void merge(const MultivariatePolynomial& other, const Combine& combine, const Single& single) {
+        checkVariables(other);
+        if (&other == this)
+            mergeTerms(terms, MultivariatePolynomial(other).terms, combine, single);
+        else
+            mergeTerms(terms, other.terms, combine, single);
+    }
+
+public:
+    explicit MultivariatePolynomial(size_t variables, T constant = T())
+        : variables(variables), fieldBits(0) {
+        if (variables == 0 || variables > 31)
+            throw std::invalid_argument("unsupported number of variables");
+        fieldBits = static_cast<unsigned>(64 / (variables + 1));
+        if (constant != T(0))
+            terms.emplace_back(0, constant);
+    }
+
+    // Sum of the given terms, each a vector of exponents, one per variable,
+    // and a coefficient.
+    MultivariatePolynomial(size_t variables, const vector<pair<vector<int>, T>>& given)
+        : MultivariatePolynomial(variables) {
+        for (const pair<vector<int>, T>& term : given)
+            terms.emplace_back(pack(term.first), term.second);
+        stable_sort(terms.begin(), terms.end(),
+                    [](const pair<uint64_t, T>& a, const pair<uint64_t, T>& b) {
+                        return a.first < b.first;
+                    });
+        size_t size = 0;
+        T zero(0);
+        for (size_t i = 0; i != terms.size(); ) {
+            pair<uint64_t, T> term = terms[i];
+            for (++i; i != terms.size() && terms[i].first == term.first; ++i)
+                term.second += terms[i].second;
+            if (term.second != zero)
+                terms[size++] = term;
+        }
+        terms.resize(size);
+    }
+
+    // The polynomial x_index.
+    static MultivariatePolynomial variable(size_t variables, size_t index) {
+        vector<int> exponents(variables, 0);
+        exponents.at(index) = 1;
+        return MultivariatePolynomial(variables, {{exponents, T(1)}});
+    }
+
+    uint64_t pack(const vector<int>& exponents) const {
+        if (exponents.size() != variables)
+            throw std::invalid_argument("wrong number of exponents");
+        uint64_t monomial = 0, total = 0;
+        for (size_t i = 0; i != variables; ++i) {
+            if (exponents[i] < 0 || static_cast<uint64_t>(exponents[i]) > maxExponent())
+                throw std::overflow_error("exponent does not fit a packed monomial");
+            total += static_cast<uint64_t>(exponents[i]);
+            monomial |= static_cast<uint64_t>(exponents[i]) << ((variables - 1 - i) * fieldBits);
+        }
+        if (total > maxExponent())
+            throw std::overflow_error("degree does not fit a packed monomial");
+        return monomial | total << (variables * fieldBits);
+    }
+
+    vector<int> unpack(uint64_t monomial) const {
+        vector<int> exponents(variables);
+        for (size_t i = 0; i != variables; ++i)
+            exponents[i] = static_cast<int>(field(monomial, i + 1));
+        return exponents;
+    }
+
+    // Terms as (packed monomial, coefficient) pairs in increasing order.
+    typename vector<pair<uint64_t, T>>::const_iterator begin() const {
+        return terms.begin();
+    }
+
+    typename vector<pair<uint64_t, T>>::const_iterator end() const {
+        return terms.end();
+    }
+
+    size_t Variables() const {
+        return variables;
+    }
+
+    // Total degree; -1 for the zero polynomial.
+    int Degree() const {
+        if (terms.empty())
+            return -1;
+        return static_cast<int>(field(terms.back().first, 0));
+    }
+
+    T operator[] (const vector<int>& exponents) const {
+        uint64_t monomial = pack(exponents);
+        auto it = lower_bound(terms.begin(), terms.end(), monomial,
+                              [](const pair<uint64_t, T>& term, uint64_t m) {
+                                  return term.first < m;
+                              });
+        if (it != terms.end() && it->first == monomial)
+            return it->second;
+        return T(0);
+    }
+
+    bool operator == (const MultivariatePolynomial& other) const {
+        return variables == other.variables && terms == other.terms;
+    }
+
+    bool operator != (const MultivariatePolynomial& other) const {
+        return !(*this == other);
+    }
+
+    MultivariatePolynomial operator +() const {
+        return *this;
+    }
+
+    MultivariatePolynomial operator -() const {
+        return *this * T(-1);
+    }
+
+    MultivariatePolynomial& operator += (const MultivariatePolynomial& other) {
+        merge(other, [](const T& a, const T& b) { return a + b; },
+              [](const T& b) { return b; });
+        return *this;
+    }
+
+    MultivariatePolynomial& operator -= (const MultivariatePolynomial& other) {
+        merge(other, [](const T& a, const T& b) { return a - b; },
+              [](const T& b) { return -b; });
+        return *this;
+    }
+
+    MultivariatePolynomial& operator *= (const MultivariatePolynomial& other) {
+        checkVariables(other);
+        if (terms.empty() || other.terms.empty()) {
+            terms.clear();
+            return *this;
+        }
+        if (static_cast<uint64_t>(Degree()) + static_cast<uint64_t>(other.Degree()) > maxExponent())
+            throw std::overflow_error("degree does not fit a packed monomial");
+        terms = productTerms(terms, other.terms);
+        return *this;
+    }
+
+    MultivariatePolynomial& operator *= (const T& k) {
+        T zero(0);
+        size_t size = 0;
+        for (pair<uint64_t, T>& term : terms) {
+            term.second *= k;
+            if (term.second != zero)
+                terms[size++] = term;
+        }
+        terms.resize(size);
+        return *this;
+    }
+
+    MultivariatePolynomial operator + (const MultivariatePolynomial& other) const {
+        MultivariatePolynomial result(*this);
+        result += other;
+        return result;
+    }
+
+    MultivariatePolynomial operator - (const MultivariatePolynomial& other) const {
+        MultivariatePolynomial result(*this);
+        result -= other;
+        return result;
+    }
+
+    MultivariatePolynomial operator * (const MultivariatePolynomial& other) const {
+        MultivariatePolynomial result(*this);
+        result *= other;
+        return result;
+    }
+
+    MultivariatePolynomial operator * (const T& k) const {
+        MultivariatePolynomial result(*this);
+        result *= k;
+        return result;
+    }
+
+    // Value at a point given by one value per variable. The powers of each
+    // variable are tabulated once up to its highest exponent.
+    T operator () (const vector<T>& point) const {
+        if (point.size() != variables)
+            throw std::invalid_argument("wrong number of values");
+        vector<vector<T>> powers(variables, vector<T>{T(1)});
+        T result(0);
+        for (const pair<uint64_t, T>& term : terms) {
+            T value = term.second;
+            for (size_t i = 0; i != variables; ++i) {
+                size_t exponent = static_cast<size_t>(field(term.first, i + 1));
+                while (powers[i].size() <= exponent)
+                    powers[i].push_back(powers[i].back() * point[i]);
+                value *= powers[i][exponent];
+            }
+            result += value;
+        }
+        return result;
+    }
+
+    // Quotient and remainder of the division by other in graded
+    // lexicographic order, computed together by the heap kernel. The
+    // remainder has no term divisible by the leading monomial of other.
+    pair<MultivariatePolynomial, MultivariatePolynomial> divmod(
+            const MultivariatePolynomial& other) const {
+        checkVariables(other);
+        if (other.terms.empty())
+            throw std::domain_error("division by zero");
+        MultivariatePolynomial quotient(variables), remainder(variables);
+        divideTerms(terms, other.terms,
+                    [this](uint64_t monomial, uint64_t divisor) { return divides(monomial, divisor); },
+                    quotient.terms, remainder.terms);
+        return {quotient, remainder};
+    }
+
+    MultivariatePolynomial operator / (const MultivariatePolynomial& other) const {
+        return divmod(other).first;
+    }
+
+    MultivariatePolynomial& operator /= (const MultivariatePolynomial& other) {
+        return *this = *this / other;
+    }
+
+    MultivariatePolynomial operator % (const MultivariatePolynomial& other) const {
+        return divmod(other).second;
+    }
+
+    MultivariatePolynomial& operator %= (const MultivariatePolynomial& other) {
+        return *this = *this % other;
+    }
+};
+
+template <typename T>
+MultivariatePolynomial<T> operator * (const T& constant, const MultivariatePolynomial<T>& polynomial) {
+    return polynomial * constant;
+}
+
+// Output format: 3*x0^2*x1-x2+1, terms from the highest monomial down.
+template <typename T>
+ostream& operator <<(ostream& out, const MultivariatePolynomial<T>& p) {
+    auto one = T(1), minusOne = T(-1), zero = T(0);
+    if (p.Degree() == -1)
+        return out << zero;
+    bool first = true;
+    for (auto it = p.end(); it != p.begin(); ) {
+        --it;
+        vector<int> exponents = p.unpack(it->first);
+        bool constant = it->first == 0;
+        T coef = it->second;
+        if (coef == one || coef == minusOne) {
+            if (coef == minusOne)
+                out << "-";
+            else if (!first)
+                out << "+";
+            if (constant)
+                out << one;
+        } else {
+            if (!first && coef > zero)
+                out << "+";
+            out << coef;
+        }
+        bool needStar = !(coef == one || coef == minusOne);
+        for (size_t i = 0; i != exponents.size(); ++i) {
+            if (exponents[i] == 0)
+                continue;
+            if (needStar)
+                out << "*";
+            out << "x" << i;
+            if (exponents[i] > 1)
+                out << "^" << exponents[i];
+            needStar = true;
+        }
+        first = false;
+    }
+    return out;
+}
@@ -0,0 +1,132 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool shared by Matrix and the polynomial classes, so that parallel
+// loops in either reuse the same workers instead of starting threads.
+
+// Fixed set of worker threads that run the chunks of one parallel loop at a
+// time. Idle threads grab the next unclaimed chunk from a shared counter, so
+// a thread that finishes early keeps taking work from the slower ones.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex submitLock, stateLock;
+    std::condition_variable wakeUp, finished;
+    const std::function<void(std::size_t)>* job = nullptr;
+    std::size_t jobSize = 0;
+    std::atomic<std::size_t> nextChunk{0};
+    std::size_t busyWorkers = 0, generation = 0;
+    bool stopping = false;
+
+    static bool& insideWorker() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    void runChunks() {
+        for (std::size_t i; (i = nextChunk++) < jobSize; )
+            (*job)(i);
+    }
+
+    void workerLoop() {
+        insideWorker() = true;
+        std::size_t seen = 0;
+        while (true) {
+            std::unique_lock<std::mutex> guard(stateLock);
+            wakeUp.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            guard.unlock();
+            runChunks();
+            guard.lock();
+            if (--busyWorkers == 0)
+                finished.notify_one();
+        }
+    }
+
+public:
+    explicit ThreadPool(std::size_t countThreads = std::thread::hardware_concurrency()) {
+        for (std::size_t i = 1; i < countThreads; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    static ThreadPool& global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    std::size_t size() const {
+        return workers.size() + 1;
+    }
+
+    // Calls task(i) for every i in [0, count) and returns once all calls are
+    // done. The calling thread takes part in the work; calls made from inside
+    // a task run serially.
+    void forEach(std::size_t count, const std::function<void(std::size_t)>& task) {
+        if (workers.empty() || count <= 1 || insideWorker()) {
+            for (std::size_t i = 0; i != count; ++i)
+                task(i);
+            return;
+        }
+        std::lock_guard<std::mutex> submitGuard(submitLock);
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            job = &task;
+            jobSize = count;
+            nextChunk = 0;
+            busyWorkers = workers.size();
+            ++generation;
+        }
+        wakeUp.notify_all();
+        // The caller counts as a worker while it runs chunks, so that a task
+        // calling forEach again runs serially instead of waiting on
+        // submitLock, which this call still holds.
+        insideWorker() = true;
+        runChunks();
+        insideWorker() = false;
+        std::unique_lock<std::mutex> guard(stateLock);
+        finished.wait(guard, [&] { return busyWorkers == 0; });
+    }
+};
+
+// Splits [0, count) into ranges of at least grain elements and processes
+// them on the global pool; body(first, last) handles one range.
+template <typename Body>
+void parallelRanges(std::size_t count, std::size_t grain, const Body& body) {
+    ThreadPool& pool = ThreadPool::global();
+    std::size_t chunks = std::min((count + grain - 1) / grain, 4 * pool.size());
+    if (chunks <= 1) {
+        body(std::size_t(0), count);
+        return;
+    }
+    std::size_t step = (count + chunks - 1) / chunks;
+    chunks = (count + step - 1) / step;
+    pool.forEach(chunks, [&](std::size_t chunk) {
+        std::size_t first = chunk * step;
+        body(first, std::min(count, first + step));
+    });
+}
+
+#endif